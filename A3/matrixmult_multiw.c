@@ -35,6 +35,12 @@
  *
     $ ./matrixmult_multiw A1.txt W1.txt W2.txt W3.txt
 
+    Run at most 2 W jobs at once (the default is one per online CPU):
+    $ ./matrixmult_multiw -j 2 A1.txt W1.txt W2.txt W3.txt
+
+    Start the jobs with posix_spawn instead of fork and exec:
+    $ ./matrixmult_multiw -x spawn A1.txt W1.txt W2.txt W3.txt
+
     $ cat 2353.out
     Starting command 1: child 2353 pid of parent 2234
      A1.txt=[...]
@@ -80,11 +86,20 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <spawn.h>
 
 #define SIZE 8
 
+extern char **environ; // Passed on to posix_spawn with COMMAND in front
+
 // Function prototypes
 int matrixMultParallel(char *const *argv, size_t n);
+pid_t startJob(char *const *argv, size_t n, int useSpawn);
+pid_t spawnJob(char *const *argv, size_t n);
+void writeChildStatus(pid_t pid, int status);
+int pidfdOpen(pid_t pid);
 void checkFile(FILE *file, const char *filename);
 void readFile(FILE *file, int rows, int cols, int matrix[][cols]);
 void printArrayContents(int rows, int cols, int matrix[][cols], char name[]);
@@ -92,9 +107,34 @@ void printArrayContents(int rows, int cols, int matrix[][cols], char name[]);
 int main(int argc, char* argv[]) {
     struct timespec start, finish;
     time_t elapsed;
+    char *program = argv[0];
+    int opt;
+
+    // -j N runs at most N W jobs at once, by default one per online CPU
+    long maxJobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int useSpawn = 0;
+    while ((opt = getopt(argc, argv, "j:x:")) != -1) {
+        switch (opt) {
+            case 'j':
+                maxJobs = atol(optarg);
+                break;
+            case 'x': // Start jobs with posix_spawn, which does not copy our page tables like fork does
+                useSpawn = strcmp(optarg, "spawn") == 0;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-j jobs] [-x fork|spawn] A.txt W1.txt [W2.txt ...]\n", program);
+                return 1;
+        }
+    }
+    if (maxJobs < 1)
+        maxJobs = 1;
+    // Shift argv so argv[1] is A.txt and argv[2...] are the W files, as before options existed
+    argc -= optind - 1;
+    argv += optind - 1;
+    argv[0] = program;
+
     int savedStdOut = dup(1);
     int savedStdErr = dup(2);
-    pid_t pidArray[argc - 2]; // Array of child pids for waitpid/writing to out files/status
     clock_gettime(CLOCK_MONOTONIC, &start); // Start the clock
 
     // Check if > 2 args are provided
@@ -103,48 +143,76 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    for (size_t n = 1; n < argc - 1; n++) {
-        // Spawn a child process
-        pid_t pid = fork();
-        pidArray[n - 1] = pid; // Store the pid
-        // If parent, continue to next child
-        if (pid < 0) {
-            fprintf(stderr, "error: fork failed\n");
-            perror("fork");
-            exit(1);
+    // Array of child pids for waitpid/writing to out files/status, on the heap for thousands of W files
+    size_t numJobs = argc - 2;
+    pid_t *pidArray = malloc(sizeof(pid_t) * numJobs);
+    int *pidfds = malloc(sizeof(int) * numJobs);
+
+    /*
+     * The W files are a queue of jobs, at most maxJobs of them run at once. Whenever one finishes the next
+     * one starts, so thousands of W files keep the machine at maxJobs processes instead of thrashing.
+     * Children are waited for in the order they finish: each child's pidfd becomes readable when it exits
+     * and epoll tells us which one directly. Kernels without pidfd_open fall back to waitpid(-1).
+     */
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    int usePidfd = epollFd >= 0;
+    size_t next = 0; // Next W job to start
+    size_t running = 0;
+    while (next < numJobs || running > 0) {
+        // Fill the pool
+        while (next < numJobs && running < maxJobs) {
+            pidArray[next] = startJob(argv, next + 1, useSpawn);
+            pidfds[next] = -1;
+            if (usePidfd) {
+                struct epoll_event event = {0};
+                event.events = EPOLLIN;
+                event.data.u32 = next;
+                pidfds[next] = pidfdOpen(pidArray[next]);
+                if (pidfds[next] < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, pidfds[next], &event) < 0)
+                    usePidfd = 0; // Jobs already watched are still reaped below through waitpid(-1)
+            }
+            next++;
+            running++;
+        }
+
+        int status;
+        if (usePidfd) {
+            struct epoll_event events[16];
+            int ready = epoll_wait(epollFd, events, 16, -1);
+            for (int e = 0; e < ready; e++) {
+                size_t i = events[e].data.u32;
+                // A job being forked may still hold a copy of the pidfd, so close alone would not unwatch it
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, pidfds[i], NULL);
+                waitpid(pidArray[i], &status, 0); // Already exited, does not block
+                writeChildStatus(pidArray[i], status);
+                close(pidfds[i]);
+                running--;
+            }
+        } else {
+            // wait for any child and write Finished child xxxx pid of parent xxxx to child_pid.out
+            pid_t pid = waitpid(-1, &status, 0);
+            if (pid < 0)
+                break;
+            for (size_t i = 0; i < next; i++) {
+                if (pidArray[i] == pid) {
+                    writeChildStatus(pid, status);
+                    if (pidfds[i] >= 0)
+                        close(pidfds[i]);
+                    running--;
+                    break;
+                }
+            }
         }
-        if (pid != 0) continue;
-        exit(matrixMultParallel(argv, n)); // Exit with the return code of the child function
     }
+    if (epollFd >= 0)
+        close(epollFd);
+    free(pidArray);
+    free(pidfds);
 
     // set stdout and stderr back to normal (just for fun)
     dup2(savedStdOut, 1);
     dup2(savedStdErr, 2);
 
-    // wait for all children in pidArray and write Finished child xxxx pid of parent xxxx to child_pid.out
-    for (size_t i = 0; i < argc - 2; i++) {
-        int status;
-        char filename[100];
-        waitpid(pidArray[i], &status, 0);
-        sprintf(filename, "%d.out", pidArray[i]);
-        int outFile = open(filename, O_RDWR | O_APPEND, 0777);
-        char parentLine[100];
-        char exitLine[100];
-
-        // Handle exit codes and signals, buffer a string to write to file
-        sprintf(parentLine, "Finished child %d pid of parent %d\n", pidArray[i], getpid());
-        if (WIFSIGNALED(status))
-            sprintf(exitLine, "Killed with signal %d\n", WTERMSIG(status));
-        else
-            sprintf(exitLine, "Exited with exitcode = %d\n", WEXITSTATUS(status));
-
-
-        //append to outfile
-        write(outFile, parentLine, strlen(parentLine));
-        write(outFile, exitLine, strlen(exitLine));
-        close(outFile);
-    }
-
     clock_gettime(CLOCK_MONOTONIC, &finish);
     elapsed = (finish.tv_sec - start.tv_sec);
 
@@ -154,6 +222,32 @@ int main(int argc, char* argv[]) {
     return 0;
 }
 
+/*
+ * This function forks the child for one W job, or spawns it with useSpawn
+ * Assumption: Called by the parent only, n is the 1 based command number
+ * Input parameters: A pointer to the argv array, the index of the W file to run, and if posix_spawn is used
+ * Returns: pid_t of the child, exits if fork fails
+*/
+pid_t startJob(char *const *argv, size_t n, int useSpawn) {
+    if (useSpawn) {
+        pid_t pid = spawnJob(argv, n);
+        if (pid > 0)
+            return pid;
+        // posix_spawn failed, fork so the exec error ends up in PID.err as usual
+    }
+
+    // Spawn a child process
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "error: fork failed\n");
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0)
+        exit(matrixMultParallel(argv, n)); // Exit with the return code of the child function
+    return pid;
+}
+
 /*
  * This function suitcases all child code in a single function. Extracted/refactored by PyCharm
  * Assumption: Will only be called by a newly forked child process
@@ -192,6 +286,98 @@ int matrixMultParallel(char *const *argv, size_t n) {
     return 1; // Will exit child with exit code 1
 }
 
+/*
+ * This function starts one W job with posix_spawn instead of fork, so the parent's page tables are not copied
+ * only to be thrown away in exec. The redirections matrixMultParallel does after fork are file actions here.
+ * The PID is not known until the child exists, so its .out and .err are opened under a temporary name and
+ * renamed once posix_spawn returns. matrixmult_parallel prints the Starting line itself from COMMAND.
+ * Assumption: Called by the parent only, n is the 1 based command number
+ * Input parameters: A pointer to the argv array, and the index of the W file to run
+ * Returns: pid_t of the child, or -1 if posix_spawn failed
+*/
+pid_t spawnJob(char *const *argv, size_t n) {
+    char out[100];
+    char err[100];
+    sprintf(out, ".spawn.%d.%d.out", getpid(), (int) n);
+    sprintf(err, ".spawn.%d.%d.err", getpid(), (int) n);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, out, O_RDWR | O_CREAT | O_APPEND, 0666);
+    posix_spawn_file_actions_addopen(&actions, 2, err, O_RDWR | O_CREAT | O_APPEND, 0666);
+
+    // COMMAND goes in front of our variables, getenv finds the first one
+    char command[40];
+    size_t count = 0;
+    while (environ[count])
+        count++;
+    char **envp = malloc(sizeof(char *) * (count + 2));
+    sprintf(command, "COMMAND=%d", (int) n);
+    envp[0] = command;
+    memcpy(envp + 1, environ, sizeof(char *) * (count + 1));
+
+    pid_t pid;
+    char *args[] = {"./matrixmult_parallel", argv[1], argv[n + 1], NULL};
+    int failed = posix_spawn(&pid, args[0], &actions, NULL, args, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    free(envp);
+
+    if (failed) {
+        unlink(out);
+        unlink(err);
+        return -1;
+    }
+
+    // Still the same open files in the child, only the names change
+    char filename[100];
+    sprintf(filename, "%d.out", pid);
+    rename(out, filename);
+    sprintf(filename, "%d.err", pid);
+    rename(err, filename);
+    return pid;
+}
+
+/*
+ * This function appends the Finished and Exited (or Killed) lines to a child's PID.out
+ * Assumption: The child has been reaped
+ * Input parameters: pid_t pid, int status from waitpid
+ * Returns: void
+*/
+void writeChildStatus(pid_t pid, int status) {
+    char filename[100];
+    sprintf(filename, "%d.out", pid);
+    int outFile = open(filename, O_RDWR | O_APPEND, 0777);
+    char parentLine[100];
+    char exitLine[100];
+
+    // Handle exit codes and signals, buffer a string to write to file
+    sprintf(parentLine, "Finished child %d pid of parent %d\n", pid, getpid());
+    if (WIFSIGNALED(status))
+        sprintf(exitLine, "Killed with signal %d\n", WTERMSIG(status));
+    else
+        sprintf(exitLine, "Exited with exitcode = %d\n", WEXITSTATUS(status));
+
+
+    //append to outfile
+    write(outFile, parentLine, strlen(parentLine));
+    write(outFile, exitLine, strlen(exitLine));
+    close(outFile);
+}
+
+/*
+ * This function opens a pidfd for a child, it becomes readable when the child exits
+ * Assumption: pid is our child
+ * Input parameters: pid_t pid
+ * Returns: int the pidfd, or -1 if the kernel does not have pidfd_open
+*/
+int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
+}
+
 /*
  * This function checks the file and prints errors if needed
  * Assumption: file is not null, there is a filename
@@ -75,6 +75,13 @@ int main(int argc, char* argv[]) {
     // time_t elapsed; // Removed for A3
     clock_gettime(CLOCK_MONOTONIC, &start);
 
+    // Set by the parent with -x spawn. There was no fork of the parent to print the Starting line, so we do
+    char *command = getenv("COMMAND");
+    if (command) {
+        fprintf(stdout, "Starting command %s: child %d pid of parent %d\n", command, getpid(), getppid());
+        fflush(stdout);
+    }
+
     // Initialize to 0
     int A[SIZE][SIZE] = {0};
     int W[SIZE][SIZE] = {0};
@@ -52,6 +52,10 @@
 #include <unistd.h>
 
 #define SIZE 8
+#define BAND_MAX (SIZE / 4) // Widest band multiplied as banded, wider bands are no cheaper than dense
+
+enum { W_DENSE, W_ZERO, W_IDENTITY, W_DIAGONAL, W_PERMUTATION, W_BANDED }; // What W looks like
+const char *wClassNames[] = {"dense", "zero", "identity", "diagonal", "permutation", "banded"};
 
 /*
  * This structure is used to pass data between processes via a pipe
@@ -69,6 +73,8 @@ void checkFile(FILE *file, const char *filename);
 void readFile(FILE *file, int rows, int cols, int matrix[][cols]);
 void printArrayContents(int rows, int cols, int matrix[][cols], char name[]);
 struct processInfo computeRowDotProduct(int matrixA[SIZE][SIZE], int matrixW[SIZE][SIZE], int rowNum);
+int classifyW(int matrixW[SIZE][SIZE], int *band);
+void computeStructured(int matrixA[SIZE][SIZE], int matrixW[SIZE][SIZE], int R[SIZE][SIZE], int wClass, int band);
 
 int main(int argc, char* argv[]) {
     struct timespec start, finish;
@@ -136,13 +142,25 @@ int main(int argc, char* argv[]) {
     printArrayContents(SIZE, SIZE, W, argv[2]);
     fflush(stdout);
 
+    // A W with structure is multiplied here in O(n) or O(n * band) per row, no children needed. Which kind of
+    // W it was only goes in the .out when W_REPORT is set, so the .out looks the same either way
+    int band = 0;
+    int wClass = classifyW(W, &band);
+    if (wClass != W_DENSE) {
+        if (getenv("W_REPORT") && wClass == W_BANDED)
+            fprintf(stdout, "%s is banded with bandwidth %d, computed without forking\n", argv[2], band);
+        else if (getenv("W_REPORT"))
+            fprintf(stdout, "%s is %s, computed without forking\n", argv[2], wClassNames[wClass]);
+        computeStructured(A, W, R, wClass, band);
+    }
+
     // Setup a pipe
     int p[2];
     pipe(p);
 
     // Spawn the children
 
-    for (size_t i = 0; i < SIZE; i++) {
+    for (size_t i = 0; wClass == W_DENSE && i < SIZE; i++) {
         int row = (int) i;
         int pid = fork();
         if (pid < 0) { // Error
@@ -173,7 +191,7 @@ int main(int argc, char* argv[]) {
      * If there are no more children running but we haven't read all the pipes,
      * exit, we have a problem.
      */
-    size_t rowsRead = 0;
+    size_t rowsRead = wClass == W_DENSE ? 0 : SIZE;
     while(rowsRead < SIZE) {
         struct processInfo info;
         /*
@@ -339,4 +357,97 @@ struct processInfo computeRowDotProduct(int matrixA[SIZE][SIZE], int matrixW[SIZ
         returnInfo.row[i] = sum; // Store the dot product
     }
     return returnInfo;
-}
\ No newline at end of file
+}
+
+/*
+ * This function finds out if W has a structure that is cheaper to multiply than a dense W
+ * Assumption: The padding past the end of the file is 0 and counts as part of W
+ * Input parameters: int matrixW[SIZE][SIZE], int *band
+ * Returns: int, one of W_DENSE, W_ZERO, W_IDENTITY, W_DIAGONAL, W_PERMUTATION or W_BANDED, sets *band to the
+ *          farthest a cell that is not 0 is from the diagonal
+*/
+int classifyW(int matrixW[SIZE][SIZE], int *band) {
+    int nonZero = 0;
+    int unitDiagonal = 1;
+    int permutation = 1; // Every row and column has a single 1 and no other value
+    int colOnes[SIZE] = {0};
+    *band = 0;
+
+    for (size_t i = 0; i < SIZE; i++) {
+        int rowOnes = 0;
+        for (size_t j = 0; j < SIZE; j++) {
+            int value = matrixW[i][j];
+            if (i == j && value != 1)
+                unitDiagonal = 0;
+            if (value == 0)
+                continue;
+            nonZero++;
+            int distance = i > j ? (int) (i - j) : (int) (j - i);
+            if (distance > *band)
+                *band = distance;
+            if (value == 1) {
+                rowOnes++;
+                colOnes[j]++;
+            } else {
+                permutation = 0;
+            }
+        }
+        if (rowOnes != 1)
+            permutation = 0;
+    }
+    for (size_t j = 0; j < SIZE; j++) {
+        if (colOnes[j] != 1)
+            permutation = 0;
+    }
+
+    if (nonZero == 0)
+        return W_ZERO;
+    if (*band == 0)
+        return unitDiagonal ? W_IDENTITY : W_DIAGONAL;
+    if (permutation)
+        return W_PERMUTATION;
+    return *band <= BAND_MAX ? W_BANDED : W_DENSE;
+}
+
+/*
+ * This function computes A * W for a W that classifyW found a structure in
+ * Assumption: wClass is not W_DENSE, R is initialized to 0
+ * Input parameters: int matrixA[SIZE][SIZE], int matrixW[SIZE][SIZE], int R[SIZE][SIZE], int wClass, int band
+ * Returns: void, fills R by reference
+*/
+void computeStructured(int matrixA[SIZE][SIZE], int matrixW[SIZE][SIZE], int R[SIZE][SIZE], int wClass, int band) {
+    size_t i, j, k;
+    int to[SIZE] = {0}; // Column row k of a permutation W has its 1 in
+    for (k = 0; wClass == W_PERMUTATION && k < SIZE; k++)
+        for (j = 0; j < SIZE; j++)
+            if (matrixW[k][j])
+                to[k] = (int) j;
+
+    for (i = 0; i < SIZE; i++) { // For each row in A
+        switch (wClass) {
+            case W_ZERO: // R stays 0
+                break;
+            case W_IDENTITY: // R is A, nothing to multiply
+                memcpy(R[i], matrixA[i], sizeof(int) * SIZE);
+                break;
+            case W_DIAGONAL: // Each column of A scaled
+                for (j = 0; j < SIZE; j++)
+                    R[i][j] = matrixA[i][j] * matrixW[j][j];
+                break;
+            case W_PERMUTATION: // Column k of A moves to column to[k]
+                for (k = 0; k < SIZE; k++)
+                    R[i][to[k]] = matrixA[i][k];
+                break;
+            case W_BANDED: // Only the cells of W within band of the diagonal
+                for (j = 0; j < SIZE; j++) {
+                    int sum = 0;
+                    size_t first = j > (size_t) band ? j - band : 0;
+                    size_t last = j + band < SIZE ? j + band : SIZE - 1;
+                    for (k = first; k <= last; k++)
+                        sum += matrixA[i][k] * matrixW[k][j];
+                    R[i][j] = sum;
+                }
+                break;
+        }
+    }
+}
@@ -50,6 +50,9 @@
     If you had your commands in a text file cmds.txt, you could also run the above with redirection or with a pipe:
     $ ./matrixmult_multiwa A1.txt W1.txt W2.txt W3.txt < cmds.txt
     $ cat cmds.txt | ./matrixmult_multiwa A1.txt W1.txt W2.txt W3.txt
+
+    Start the children with posix_spawn instead of fork and exec:
+    $ ./matrixmult_multiwa -x spawn A1.txt W1.txt W2.txt W3.txt < cmds.txt
  */
 
 #include <stdio.h>
@@ -60,11 +63,29 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 
 #define SIZE 8
 #define READ_END 0
 #define WRITE_END 1
 #define MATRIX_SIZE sizeof(int) * SIZE * SIZE
+#define NAME_SIZE 100 // A filenames of 100 chars max, see 8) above
+#define JOBSERVER_MAX 4096 // Tokens that fit in a pipe without blocking
+
+/*
+ * This structure is one request sent down a child's pipe
+ * Assumption: Small enough (< PIPE_BUF) that each write to the pipe is atomic
+ * Input parameters: the request number, the A filename and the A matrix
+ * Returns: Nothing, the child logs name itself so its PID.out stays in order
+*/
+struct requestInfo {
+    int seq;
+    char name[NAME_SIZE];
+    int A[SIZE][SIZE];
+} typedef requestInfo;
 
 /*
  * This structure is used to store the pid information
@@ -75,11 +96,19 @@
 struct pidInfo {
     pid_t pid;
     int pipe[2];
+    int outFile; // PID.out, kept open by the parent until the child is reaped
+    int pidfd; // Readable once the child exits, -1 if the kernel has no pidfd_open
 } typedef pidInfo;
 
+extern char **environ; // Passed on to posix_spawn with COMMAND in front
+
 // Function prototypes
 int matrixMultParallel(char *const *wFiles, size_t n, pidInfo child);
+pid_t spawnChild(char *const *wFiles, size_t n, pidInfo child);
+void finishChild(pidInfo *child, int status);
+int pidfdOpen(pid_t pid);
 void checkFile(FILE *file, const char *filename);
+void jobserverCreate(int tokens);
 void readFile(FILE *file, int rows, int cols, int matrix[][cols]);
 void printArrayContents(int rows, int cols, int matrix[][cols], char name[]);
 
@@ -88,15 +117,36 @@ int main(int argc, char* argv[]) {
     time_t elapsed;
     char *line = NULL;  // For getline
     size_t len = 0;  // For getlin
+    char *program = argv[0];
+    int opt;
+
+    // -x spawn starts the children with posix_spawn, which does not copy our page tables like fork does
+    int useSpawn = 0;
+    while ((opt = getopt(argc, argv, "x:")) != -1) {
+        switch (opt) {
+            case 'x':
+                useSpawn = strcmp(optarg, "spawn") == 0;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-x fork|spawn] A.txt W1.txt [W2.txt ...]\n", program);
+                return 1;
+        }
+    }
+    // Shift argv so argv[1] is A.txt and argv[2...] are the W files, as before options existed
+    argc -= optind - 1;
+    argv += optind - 1;
+    argv[0] = program;
+
     int numChildren = argc - 2;
     char **wFiles = malloc(sizeof(char *) * (numChildren + 1)); // A.txt stored, so +1
-    int A[SIZE][SIZE] = {0};
+    requestInfo request = {0};
 
     // Open up A.txt which will be passed via pipes
     FILE *fileA = fopen(argv[1], "r");
     checkFile(fileA, argv[1]);
-    readFile(fileA, SIZE, SIZE, A);
+    readFile(fileA, SIZE, SIZE, request.A);
     fclose(fileA);
+    snprintf(request.name, NAME_SIZE, "%s", argv[1]);
 
     pidInfo pidArray[numChildren]; // Array of child pids for waitpid/writing to out files/status and parent > child pipe
     clock_gettime(CLOCK_MONOTONIC, &start); // Start the clock
@@ -116,12 +166,19 @@ int main(int argc, char* argv[]) {
         strcpy(wFiles[i], argv[i + 1]);
     }
 
+    // One token per core, shared by the row processes of every child
+    jobserverCreate((int) sysconf(_SC_NPROCESSORS_ONLN));
+
     // This loop spawns all the children and passes the initial A.txt to them
     for (size_t n = 0; n < numChildren; n++) {
         // Spawn a child process
         pidInfo child;
         pipe(child.pipe);
-        pid_t pid = fork();
+        pid_t pid = -1;
+        if (useSpawn)
+            pid = spawnChild(argv, n + 1, child); // -1 if it failed, fork then reports the error the usual way
+        if (pid < 0)
+            pid = fork();
         child.pid = pid;
         pidArray[n] = child; // Store the pid
         // If parent, continue to next child
@@ -132,8 +189,14 @@ int main(int argc, char* argv[]) {
         }
         // If parent, write to pipe then continue to next child
         if (pid != 0) {
-            // Write rSum to the pipe
-            write(pidArray[n].pipe[WRITE_END], A, MATRIX_SIZE);
+            // Open PID.out once for the Finished/Exited lines, O_CREAT since the child may not have yet
+            char filename[100];
+            sprintf(filename, "%d.out", pid);
+            pidArray[n].outFile = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            close(pidArray[n].pipe[READ_END]);
+
+            // Write the first request to the pipe
+            write(pidArray[n].pipe[WRITE_END], &request, sizeof(request));
             continue;
         }
         // Child only code below here
@@ -147,25 +210,19 @@ int main(int argc, char* argv[]) {
         token = strtok(line, " "); // Strip whitespace, get the first token as a C-string
         if(token) {
             // Zero out A
-            memset(A, 0, MATRIX_SIZE);
+            memset(request.A, 0, MATRIX_SIZE);
 
             // Open the file
             FILE *newFileA = fopen(line, "r");
             checkFile(newFileA, line);
-            readFile(newFileA, SIZE, SIZE, A);
+            readFile(newFileA, SIZE, SIZE, request.A);
             fclose(newFileA);
+            request.seq++;
+            snprintf(request.name, NAME_SIZE, "%s", line);
 
-            // Write to every pipe in pidArray
+            // Write to every pipe in pidArray, the child logs the filename to PID.out itself
             for (size_t i = 0; i < numChildren; i++) {
-                // Append filename to the end of every child's .out file
-                char filename[100];
-                sprintf(filename, "%d.out", pidArray[i].pid);
-                int outFile = open(filename, O_RDWR | O_APPEND, 0777);
-                write(outFile, line, strlen(line));
-                close(outFile);
-
-                // Write to the pipe
-                write(pidArray[i].pipe[WRITE_END], A, MATRIX_SIZE);
+                write(pidArray[i].pipe[WRITE_END], &request, sizeof(request));
             }
         }
     }
@@ -175,37 +232,49 @@ int main(int argc, char* argv[]) {
         close(pidArray[i].pipe[WRITE_END]);
     }
 
-    // wait for all children in pidArray and write Finished child xxxx pid of parent xxxx to child_pid.out
-    int currentChild;
+    /*
+     * Wait for the children in the order they finish. Each child's pidfd becomes readable when it exits and
+     * the epoll data points at its pidInfo, so there is no pid to look up. Kernels without pidfd_open fall
+     * back to wait() and a scan of pidArray.
+     */
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    int watching = 0;
+    for (size_t i = 0; i < numChildren; i++) {
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.ptr = &pidArray[i];
+        pidArray[i].pidfd = epollFd >= 0 ? pidfdOpen(pidArray[i].pid) : -1;
+        if (pidArray[i].pidfd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, pidArray[i].pidfd, &event) == 0)
+            watching++;
+    }
+
     int status;
-    while ((currentChild = wait(&status)) > 0) {
-    //for (size_t i = 0; i < numChildren; i++) {
-        // Get the right pid
-        int i = 0;
-        for (i = 0; i < numChildren; i++) {
-            if (pidArray[i].pid == currentChild)
-                break;
+    if (watching == numChildren) {
+        while (watching > 0) {
+            struct epoll_event events[16];
+            int ready = epoll_wait(epollFd, events, 16, -1);
+            for (int e = 0; e < ready; e++) {
+                pidInfo *child = events[e].data.ptr;
+                waitpid(child->pid, &status, 0); // Already exited, does not block
+                finishChild(child, status);
+                watching--;
+            }
+        }
+    } else {
+        // wait for all children in pidArray and write Finished child xxxx pid of parent xxxx to child_pid.out
+        int currentChild;
+        while ((currentChild = wait(&status)) > 0) {
+            // Get the right pid
+            int i = 0;
+            for (i = 0; i < numChildren; i++) {
+                if (pidArray[i].pid == currentChild)
+                    break;
+            }
+            finishChild(&pidArray[i], status);
         }
-
-        char filename[100];
-        sprintf(filename, "%d.out", pidArray[i].pid);
-        int outFile = open(filename, O_RDWR | O_APPEND, 0777);
-        char parentLine[100];
-        char exitLine[100];
-
-        // Handle exit codes and signals, buffer a string to write to file
-        sprintf(parentLine, "Finished child %d pid of parent %d\n", pidArray[i].pid, getpid());
-        if (WIFSIGNALED(status))
-            sprintf(exitLine, "Killed with signal %d\n", WTERMSIG(status));
-        else
-            sprintf(exitLine, "Exited with exitcode = %d\n", WEXITSTATUS(status));
-
-
-        //append to outfile
-        write(outFile, parentLine, strlen(parentLine));
-        write(outFile, exitLine, strlen(exitLine));
-        close(outFile);
     }
+    if (epollFd >= 0)
+        close(epollFd);
 
     clock_gettime(CLOCK_MONOTONIC, &finish);
     elapsed = (finish.tv_sec - start.tv_sec);
@@ -251,7 +320,6 @@ int matrixMultParallel(char *const *wFiles, size_t n, pidInfo child) {
     close(newStdErr);
 
     fprintf(stdout, "Starting command %d: child %d pid of parent %d\n", (int) n, getpid(), getppid());
-    fprintf(stdout, "%s", wFiles[1]);
     fflush(stdout);
 
     // create args and call with execvp
@@ -265,6 +333,102 @@ int matrixMultParallel(char *const *wFiles, size_t n, pidInfo child) {
     return 1; // Will exit child with exit code 1
 }
 
+/*
+ * This function appends the Finished and Exited (or Killed) lines to a child's PID.out and closes its fds
+ * Assumption: The child has been reaped
+ * Input parameters: pidInfo *child, int status from waitpid
+ * Returns: void
+*/
+void finishChild(pidInfo *child, int status) {
+    char parentLine[100];
+    char exitLine[100];
+
+    // Handle exit codes and signals, buffer a string to write to file
+    sprintf(parentLine, "Finished child %d pid of parent %d\n", child->pid, getpid());
+    if (WIFSIGNALED(status))
+        sprintf(exitLine, "Killed with signal %d\n", WTERMSIG(status));
+    else
+        sprintf(exitLine, "Exited with exitcode = %d\n", WEXITSTATUS(status));
+
+
+    //append both lines to outfile in one writev
+    struct iovec lines[2] = {
+        {parentLine, strlen(parentLine)},
+        {exitLine, strlen(exitLine)}
+    };
+    writev(child->outFile, lines, 2);
+    close(child->outFile);
+    if (child->pidfd >= 0)
+        close(child->pidfd);
+}
+
+/*
+ * This function opens a pidfd for a child, it becomes readable when the child exits
+ * Assumption: pid is our child
+ * Input parameters: pid_t pid
+ * Returns: int the pidfd, or -1 if the kernel does not have pidfd_open
+*/
+int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
+}
+
+/*
+ * This function starts child n with posix_spawn instead of fork, so the parent's page tables are not copied
+ * only to be thrown away in exec. The redirections matrixMultParallel does after fork are file actions here.
+ * The PID is not known until the child exists, so its .out and .err are opened under a temporary name and
+ * renamed once posix_spawn returns. matrixmult_parallel prints the Starting line itself from COMMAND.
+ * Assumption: child.pipe is open
+ * Input parameters: char *const *wFiles, size_t n, pidInfo child
+ * Returns: pid_t of the child, or -1 if posix_spawn failed
+*/
+pid_t spawnChild(char *const *wFiles, size_t n, pidInfo child) {
+    char out[100];
+    char err[100];
+    sprintf(out, ".spawn.%d.%d.out", getpid(), (int) n);
+    sprintf(err, ".spawn.%d.%d.err", getpid(), (int) n);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, out, O_RDWR | O_CREAT | O_APPEND, 0666);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, err, O_RDWR | O_CREAT | O_APPEND, 0666);
+    posix_spawn_file_actions_adddup2(&actions, child.pipe[READ_END], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, child.pipe[WRITE_END]);
+
+    // COMMAND goes in front of our variables, getenv finds the first one
+    char command[40];
+    size_t count = 0;
+    while (environ[count])
+        count++;
+    char **envp = malloc(sizeof(char *) * (count + 2));
+    sprintf(command, "COMMAND=%d", (int) n);
+    envp[0] = command;
+    memcpy(envp + 1, environ, sizeof(char *) * (count + 1));
+
+    pid_t pid;
+    char *args[] = {"./matrixmult_parallel", wFiles[0], wFiles[n + 1], NULL};
+    int failed = posix_spawn(&pid, args[0], &actions, NULL, args, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    free(envp);
+
+    if (failed) {
+        unlink(out);
+        unlink(err);
+        return -1;
+    }
+
+    // Still the same open files in the child, only the names change
+    char filename[100];
+    sprintf(filename, "%d.out", pid);
+    rename(out, filename);
+    sprintf(filename, "%d.err", pid);
+    rename(err, filename);
+    return pid;
+}
+
 
 /*
  * This function checks the file and prints errors if needed
@@ -279,6 +443,30 @@ void checkFile(FILE *file, const char *filename) {
     }
 }
 
+/*
+ * This function sets up the token jobserver shared by the whole process tree, like make's. The pipe holds
+ * one byte per compute worker allowed to run, a worker at any level reads a byte before computing and
+ * writes it back after. The fds are left open across exec and passed down in JOBSERVER, like PIPE in A4.
+ * Assumption: Called before any child is spawned
+ * Input parameters: int tokens (0 turns it off)
+ * Returns: void, a JOBSERVER already in the environment (from a parent up the tree) is kept as is
+*/
+void jobserverCreate(int tokens) {
+    int fds[2];
+    char value[32];
+    char token = '+';
+
+    if (tokens <= 0 || getenv("JOBSERVER") || pipe(fds) < 0)
+        return;
+    if (tokens > JOBSERVER_MAX)
+        tokens = JOBSERVER_MAX; // All of them have to fit in the pipe at once
+    for (int i = 0; i < tokens; i++)
+        write(fds[WRITE_END], &token, 1);
+
+    snprintf(value, sizeof(value), "%d,%d", fds[READ_END], fds[WRITE_END]);
+    setenv("JOBSERVER", value, 1);
+}
+
 /*
  * This function reads the file and populates the given matrix.
  * Assumption: file has been checked, matrix is already initialized, and rows and columns are known
@@ -12,11 +12,13 @@
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <errno.h>
 
 #define SIZE 8
 #define READ_END 0
 #define WRITE_END 1
 #define MATRIX_SIZE sizeof(int) * SIZE * SIZE
+#define NAME_SIZE 100 // A filenames of 100 chars max, same as the parent
 
 /*
  * This structure is used to pass data between processes via a pipe
@@ -29,18 +31,43 @@ struct processInfo {
     int row[SIZE];
 } typedef processInfo;
 
+/*
+ * This structure is one request read from the parent's pipe
+ * Assumption: Matches requestInfo in matrixmult_multiwa.c
+ * Input parameters: the request number, the A filename and the A matrix
+ * Returns: Nothing
+*/
+struct requestInfo {
+    int seq;
+    char name[NAME_SIZE];
+    int A[SIZE][SIZE];
+} typedef requestInfo;
+
 // Function prototypes
 void checkFile(FILE *file, const char *filename);
 void readFile(FILE *file, int rows, int cols, int matrix[][cols]);
 void printArrayContents(int rows, int cols, int matrix[][cols], char name[]);
 processInfo computeRowDotProduct(int matrixA[SIZE][SIZE], int matrixW[SIZE][SIZE], int rowNum);
+void jobserverOpen(void);
+void jobserverAcquire(void);
+void jobserverRelease(void);
+
+int jobRead = -1; // JOBSERVER token pipe from the parent, -1 if there is none
+int jobWrite = -1;
 
 int main(int argc, char* argv[]) {
     // Initialize to 0
-    int A[SIZE][SIZE] = {0};
+    requestInfo request = {0};
     int W[SIZE][SIZE] = {0};
     int iterationNum = 0;
 
+    // Set by parent with -x spawn. There was no fork of the parent to print the Starting line, so we do
+    char *command = getenv("COMMAND");
+    if (command) {
+        fprintf(stdout, "Starting command %s: child %d pid of parent %d\n", command, getpid(), getppid());
+        fflush(stdout);
+    }
+
     // Check if 3 args are provided
     if (argc != 3) { // argv[0] is program name
         fprintf(stderr, "Error - expecting exactly 2 files as input\n");
@@ -52,11 +79,12 @@ int main(int argc, char* argv[]) {
     checkFile(fileW, argv[2]);
     readFile(fileW, SIZE, SIZE, W);
     fclose(fileW);
+    jobserverOpen();
 
     // declare R as a dynamic array of SIZE * SIZE
     int **R = NULL;
 
-    while (read(STDIN_FILENO, &A, MATRIX_SIZE) > 0) {
+    while (read(STDIN_FILENO, &request, sizeof(request)) > 0) {
         // Realloc R to be (SIZE * SIZE) * iterationNum
         int oldSize = SIZE * iterationNum;
         R = realloc(R, sizeof(int *) * SIZE * (++iterationNum));
@@ -65,9 +93,8 @@ int main(int argc, char* argv[]) {
             R[i] = malloc(sizeof(int) * SIZE);
         }
 
-        char filename[100];
-        sprintf(filename, " x %s\n", argv[2]);
-        fprintf(stdout, "%s", filename);
+        // Log the A filename from the request, so PID.out is in the order the requests arrived
+        fprintf(stdout, "%s x %s\n", request.name, argv[2]);
         fflush(stdout);
 
         // Setup a pipe
@@ -85,8 +112,10 @@ int main(int argc, char* argv[]) {
             if (pid == 0) { // Child
                 // Close read end of pipe
                 close(p[READ_END]);
-                // Compute the dot product
-                processInfo info = computeRowDotProduct(A, W, row);
+                // Compute the dot product, only while holding a token
+                jobserverAcquire();
+                processInfo info = computeRowDotProduct(request.A, W, row);
+                jobserverRelease();
                 info.rowNum = row;
                 // Write the result to the pipe
                 write(p[WRITE_END], &info, sizeof(info));
@@ -127,7 +156,7 @@ int main(int argc, char* argv[]) {
 
         }
         // Zero out A
-        memset(A, 0, MATRIX_SIZE);
+        memset(request.A, 0, MATRIX_SIZE);
 
         // close every pipe
         close(p[READ_END]);
@@ -248,4 +277,43 @@ processInfo computeRowDotProduct(int matrixA[SIZE][SIZE], int matrixW[SIZE][SIZE
         returnInfo.row[i] = sum; // Store the dot product
     }
     return returnInfo;
-}
\ No newline at end of file
+}
+
+/*
+ * This function reads the JOBSERVER fds from the environment
+ * Assumption: Set by the parent as "readfd,writefd"
+ * Input parameters: none
+ * Returns: void, jobRead and jobWrite stay -1 without a JOBSERVER
+*/
+void jobserverOpen(void) {
+    char *jobserver = getenv("JOBSERVER");
+    if (!jobserver || sscanf(jobserver, "%d,%d", &jobRead, &jobWrite) != 2)
+        jobRead = jobWrite = -1;
+}
+
+/*
+ * This function takes a token from the JOBSERVER pipe, waiting until a compute worker anywhere in the tree
+ * gives one back
+ * Assumption: jobserverOpen was called, does nothing without a JOBSERVER
+ * Input parameters: none
+ * Returns: void
+*/
+void jobserverAcquire(void) {
+    char token;
+    if (jobRead < 0)
+        return;
+    while (read(jobRead, &token, 1) < 0 && errno == EINTR)
+        ; // Interrupted, try again
+}
+
+/*
+ * This function gives a token back to the JOBSERVER pipe
+ * Assumption: jobserverAcquire was called by this worker
+ * Input parameters: none
+ * Returns: void
+*/
+void jobserverRelease(void) {
+    char token = '+';
+    if (jobWrite >= 0)
+        write(jobWrite, &token, 1);
+}
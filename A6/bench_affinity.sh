@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# Affinity benchmark: the same run with each child unpinned, pinned to its own cores and pinned to a NUMA node.
+# With perf installed the cache misses of the whole tree are counted, otherwise only the runtime is shown.
+# The difference shows up on a host with several sockets and more W children than cores per socket.
+#   ./bench_affinity.sh                     (SIZE=256, CHILDREN=number of cores, REQUESTS=32)
+#   SIZE=512 CHILDREN=16 ./bench_affinity.sh
+
+SIZE=${SIZE:-256}
+CHILDREN=${CHILDREN:-$(nproc)}
+REQUESTS=${REQUESTS:-32}
+DIR=$(mktemp -d)
+
+echo "Building for ${SIZE}x${SIZE} in $DIR"
+gcc -O2 -pthread -DSIZE="$SIZE" -o "$DIR/matrixmult_threaded" matrixmult_threaded.c -D_REENTRANT -Wall -Werror || exit 1
+gcc -O2 -pthread -DSIZE="$SIZE" -o "$DIR/matrixmult_multiwa" matrixmult_multiwa.c -Wall -Werror || exit 1
+
+# Random 0..9 matrices, one W per child and REQUESTS A's on stdin
+WFILES=""
+for i in $(seq 0 "$CHILDREN"); do
+    name=W$i.txt
+    [ "$i" -eq 0 ] && name=A.txt
+    awk -v n="$SIZE" -v seed="$RANDOM" 'BEGIN { srand(seed); for (i = 0; i < n; i++) { line = "";
+        for (j = 0; j < n; j++) line = line int(rand() * 10) " "; print line } }' > "$DIR/$name"
+    [ "$i" -gt 0 ] && WFILES="$WFILES $name"
+done
+for i in $(seq 1 "$REQUESTS"); do echo "A.txt"; done > "$DIR/cmds.txt"
+
+cd "$DIR" || exit 1
+for mode in none core node; do
+    rm -f ./*.out ./*.err
+    echo "-a $mode"
+    if command -v perf > /dev/null; then
+        # -J 0 so the jobserver does not change the schedule being measured
+        perf stat -e cache-misses,L1-dcache-load-misses,LLC-load-misses,cpu-migrations \
+            ./matrixmult_multiwa -J 0 -a $mode A.txt $WFILES < cmds.txt 2>&1 | grep -E "misses|migrations|runtime"
+    else
+        ./matrixmult_multiwa -J 0 -a $mode A.txt $WFILES < cmds.txt | grep runtime
+    fi
+done
+
+cd - > /dev/null && rm -rf "$DIR"
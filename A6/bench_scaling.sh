@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Scaling benchmark for the threaded engine: SIZE x SIZE products of one A and one W with 1 to MAX workers.
+# Products of at least 128x128 are scheduled with work stealing, see runStealing in matrixmult_threaded.c
+#   ./bench_scaling.sh                      (SIZE=512, MAX=number of cores, REQUESTS=8)
+#   SIZE=1024 MAX=16 ./bench_scaling.sh
+
+SIZE=${SIZE:-512}
+MAX=${MAX:-$(nproc)}
+REQUESTS=${REQUESTS:-8}
+DIR=$(mktemp -d)
+
+echo "Building for ${SIZE}x${SIZE} in $DIR"
+gcc -O2 -pthread -DSIZE="$SIZE" -o "$DIR/matrixmult_threaded" matrixmult_threaded.c -D_REENTRANT -Wall -Werror || exit 1
+gcc -O2 -pthread -DSIZE="$SIZE" -o "$DIR/matrixmult_multiwa" matrixmult_multiwa.c -Wall -Werror || exit 1
+
+# Random 0..9 matrices, and REQUESTS more A's on stdin
+for name in A W; do
+    awk -v n="$SIZE" -v seed="$RANDOM" 'BEGIN { srand(seed); for (i = 0; i < n; i++) { line = "";
+        for (j = 0; j < n; j++) line = line int(rand() * 10) " "; print line } }' > "$DIR/$name.txt"
+done
+for i in $(seq 1 "$REQUESTS"); do echo "A.txt"; done > "$DIR/cmds.txt"
+
+cd "$DIR" || exit 1
+echo "workers  seconds  speedup"
+for workers in $(seq 1 "$MAX"); do
+    rm -f ./*.out ./*.err
+    # -J 0 so the jobserver does not cap the workers being measured
+    seconds=$(WORKERS=$workers ./matrixmult_multiwa -J 0 -p threaded A.txt W.txt < cmds.txt | awk '/runtime/ { print $3 }')
+    [ "$workers" -eq 1 ] && base=$seconds
+    echo "$workers $seconds $base" | awk '{ printf "%7d  %7.3f  %7.2f\n", $1, $2, $3 / $2 }'
+done
+
+cd - > /dev/null && rm -rf "$DIR"
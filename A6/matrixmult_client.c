@@ -0,0 +1,407 @@
+/*
+ * Description: Sends A matrices to a matrixmult_multiwa daemon (-d) and prints every product it sends back
+ * Author names: Trevor Mathisen
+ * Author emails: trevor.mathisen@sjsu.edu
+ * Last modified date: 10/18/2026
+ * Creation date: 10/18/2026
+ */
+
+/* Example:
+    $ ./matrixmult_multiwa -d mm.sock test/A1.txt test/W1.txt test/W2.txt test/W3.txt &
+
+    Same input as matrixmult_multiwa, one A filename per line, any number of clients at once:
+    $ ./matrixmult_client mm.sock < cmds.txt
+    test/A2.txt x test/W1.txt=[
+    ...
+    ]
+
+    Or the A files as arguments:
+    $ ./matrixmult_client mm.sock test/A1.txt test/A3.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef SIZE
+#define SIZE 8 // Same -DSIZE=N as the daemon
+#endif
+#define LINE_SIZE (SIZE * 12 + 2) // Longest line readFile takes, SIZE ints and their spaces
+#define NAME_SIZE 100 // A filenames of 100 chars max, same as the daemon
+
+/*
+ * This structure is one A matrix sent to the daemon
+ * Assumption: Matches clientRequest in matrixmult_multiwa.c
+ * Input parameters: our number for the request, the A filename and the A matrix
+ * Returns: Nothing
+*/
+struct clientRequest {
+    int tag;
+    char name[NAME_SIZE];
+    int A[SIZE][SIZE];
+} typedef clientRequest;
+
+/*
+ * This structure is what the daemon sends once we connect, followed by numW W filenames of NAME_SIZE chars
+ * Assumption: Matches serverHello in matrixmult_multiwa.c
+ * Input parameters: the matrix size and the number of W files
+ * Returns: Nothing
+*/
+struct serverHello {
+    char magic[8];
+    int size;
+    int numW;
+} typedef serverHello;
+
+/*
+ * This structure is one product from the daemon, numW of them per request in W order
+ * Assumption: Matches serverReply in matrixmult_multiwa.c, R is only sent for REPLY_OK
+ * Input parameters: the request's tag, the W number, the status and the product
+ * Returns: Nothing
+*/
+struct serverReply {
+    int tag;
+    int w;
+    int status;
+    int R[SIZE][SIZE];
+} typedef serverReply;
+
+enum { REPLY_OK, REPLY_DROPPED, REPLY_NONE }; // What the daemon sends for each W
+
+/*
+ * This structure is shared by the sending and the receiving side of the client
+ * Assumption: names grows under lock as requests are sent, the reader looks them up by tag
+ * Input parameters: the socket and the W filenames from the hello
+ * Returns: Nothing
+*/
+struct clientState {
+    int fd;
+    int numW;
+    char (*wNames)[NAME_SIZE];
+    char (*names)[NAME_SIZE]; // names[tag] is the A filename of request tag
+    int capacity;
+    int sent;
+    pthread_mutex_t lock;
+} typedef clientState;
+
+// Function prototypes
+int connectDaemon(const char *path, clientState *state);
+void sendRequest(clientState *state, const char *name);
+void* readReplies(void* givenState);
+int readAll(int fd, void *buf, size_t len);
+void checkFile(FILE *file, const char *filename);
+void readFile(FILE *file, int rows, int cols, int matrix[][cols]);
+void readMatrixMarket(FILE *file, const char *header, int rows, int cols, int matrix[][cols]);
+void printArrayContents(int rows, int cols, int matrix[][cols], char name[]);
+
+int main(int argc, char* argv[]) {
+    clientState state;
+    char *line = NULL; // For getline
+    size_t len = 0;
+
+    if (argc < 2) { // argv[0] is program name
+        fprintf(stderr, "usage: %s socket [A.txt ...]\n", argv[0]);
+        return 1;
+    }
+    if (connectDaemon(argv[1], &state) < 0)
+        return 1;
+
+    // Products are printed as they come back while we keep sending
+    pthread_t reader;
+    pthread_create(&reader, NULL, readReplies, &state);
+
+    // The A files are the arguments, or one per line of stdin like matrixmult_multiwa
+    if (argc > 2) {
+        for (int i = 2; i < argc; i++)
+            sendRequest(&state, argv[i]);
+    } else {
+        while (getline(&line, &len, stdin) > 0) {
+            char *token = strtok(line, " \n"); // Strip whitespace, get the first token as a C-string
+            if (token)
+                sendRequest(&state, token);
+        }
+    }
+
+    // Done sending, the daemon closes the socket after our last reply
+    shutdown(state.fd, SHUT_WR);
+    pthread_join(reader, NULL);
+
+    close(state.fd);
+    free(line);
+    free(state.wNames);
+    free(state.names);
+    pthread_mutex_destroy(&state.lock);
+    return 0;
+}
+
+/*
+ * This function connects to the daemon and reads its hello
+ * Assumption: The daemon was built with the same SIZE
+ * Input parameters: const char *path, clientState *state
+ * Returns: int (0) on success, (-1) after printing an error
+*/
+int connectDaemon(const char *path, clientState *state) {
+    struct sockaddr_un addr = {0};
+    serverHello hello;
+
+    memset(state, 0, sizeof(clientState));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    state->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (state->fd < 0 || connect(state->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "error: cannot connect to %s\n", path);
+        perror("connect");
+        return -1;
+    }
+
+    if (!readAll(state->fd, &hello, sizeof(hello)) || memcmp(hello.magic, "MMDAEMON", 8) != 0) {
+        fprintf(stderr, "error: %s is not a matrixmult_multiwa daemon\n", path);
+        return -1;
+    }
+    if (hello.size != SIZE) {
+        fprintf(stderr, "error: the daemon is built for %dx%d matrices, we are %dx%d\n", hello.size, hello.size,
+                SIZE, SIZE);
+        return -1;
+    }
+
+    state->numW = hello.numW;
+    state->wNames = malloc(NAME_SIZE * (hello.numW > 0 ? hello.numW : 1));
+    if (!readAll(state->fd, state->wNames, NAME_SIZE * hello.numW)) {
+        fprintf(stderr, "error: %s closed the connection\n", path);
+        return -1;
+    }
+    pthread_mutex_init(&state->lock, NULL);
+    return 0;
+}
+
+/*
+ * This function reads an A file and sends it to the daemon
+ * Assumption: Only called by the main thread
+ * Input parameters: clientState *state, const char *name
+ * Returns: void, exits if the file cannot be opened like matrixmult_multiwa does
+*/
+void sendRequest(clientState *state, const char *name) {
+    clientRequest *request = calloc(1, sizeof(clientRequest)); // On the heap since it gets big with -DSIZE
+
+    FILE *fileA = fopen(name, "r");
+    checkFile(fileA, name);
+    readFile(fileA, SIZE, SIZE, request->A);
+    fclose(fileA);
+    snprintf(request->name, NAME_SIZE, "%s", name);
+
+    // Remember the name under its tag before the reply can come back
+    pthread_mutex_lock(&state->lock);
+    if (state->sent == state->capacity) {
+        state->capacity = state->capacity ? state->capacity * 2 : 64;
+        state->names = realloc(state->names, NAME_SIZE * state->capacity);
+    }
+    request->tag = state->sent;
+    memcpy(state->names[state->sent], request->name, NAME_SIZE);
+    state->sent++;
+    pthread_mutex_unlock(&state->lock);
+
+    size_t done = 0;
+    while (done < sizeof(clientRequest)) {
+        ssize_t n = write(state->fd, (char *) request + done, sizeof(clientRequest) - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            fprintf(stderr, "error: the daemon closed the connection\n");
+            exit(1);
+        }
+        done += n;
+    }
+    free(request);
+}
+
+/*
+ * This function is the reader thread, it prints every product the daemon sends back
+ * Assumption: Replies for a request come in W order, after it was sent
+ * Input parameters: void* givenState
+ * Returns: void*, NULL once the daemon closes the socket
+*/
+void* readReplies(void* givenState) {
+    clientState *state = (clientState*) givenState;
+    serverReply *reply = malloc(sizeof(serverReply)); // On the heap since it gets big with -DSIZE
+    size_t header = offsetof(serverReply, R);
+    int replies = 0;
+
+    while (readAll(state->fd, reply, header)) {
+        if (reply->status == REPLY_OK && !readAll(state->fd, reply->R, sizeof(reply->R)))
+            break;
+
+        char name[2 * NAME_SIZE + 4];
+        pthread_mutex_lock(&state->lock);
+        snprintf(name, sizeof(name), "%s x %s", state->names[reply->tag], state->wNames[reply->w]);
+        pthread_mutex_unlock(&state->lock);
+
+        if (reply->status == REPLY_OK)
+            printArrayContents(SIZE, SIZE, reply->R, name);
+        else if (reply->status == REPLY_DROPPED)
+            fprintf(stdout, "%s: dropped, the child was too far behind\n", name);
+        else
+            fprintf(stdout, "%s: no result, the child exited\n", name);
+        replies++;
+    }
+    fflush(stdout);
+
+    if (replies < state->sent * state->numW)
+        fprintf(stderr, "error: %d of %d products did not come back\n", state->sent * state->numW - replies,
+                state->sent * state->numW);
+    free(reply);
+    return NULL;
+}
+
+/*
+ * This function reads exactly len bytes
+ * Assumption: fd is blocking
+ * Input parameters: int fd, void *buf, size_t len
+ * Returns: int (1) once len bytes are read, (0) at EOF or on an error
+*/
+int readAll(int fd, void *buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, (char *) buf + got, len - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        got += n;
+    }
+    return 1;
+}
+
+/*
+ * This function checks the file and prints errors if needed
+ * Assumption: file is not null, there is a filename
+ * Input parameters: FILE *file, const char *filename
+ * Returns: void, exits if needed
+*/
+void checkFile(FILE *file, const char *filename) {
+    if (file == NULL) { // If there is no file, or you can't access it
+        fprintf(stderr, "error: cannot open file %s\n", filename);
+        exit(1); // End the program here, do not return
+    }
+}
+
+/*
+ * This function reads the file and populates the given matrix.
+ * Assumption: file has been checked, matrix is already initialized, and rows and columns are known
+ * Input parameters: FILE *file, int rows, int cols, int matrix[][cols]
+ * Returns: void, updates matrix by reference
+*/
+void readFile(FILE *file, int rows, int cols, int matrix[][cols]) {
+    // Initialize row and column counters
+    size_t i = 0;
+    size_t j = 0;
+
+    // Read the file line by line
+    char *buf = malloc(LINE_SIZE);
+    while (fgets(buf, LINE_SIZE, file) != NULL) {
+
+        // A Matrix Market file says so on its first line, the rest of it is read differently
+        if (i == 0 && strncmp(buf, "%%MatrixMarket", 14) == 0) {
+            readMatrixMarket(file, buf, rows, cols, matrix);
+            break;
+        }
+
+        // Remove trailing newline character
+        if (buf[strlen(buf) - 1] == '\n') buf[strlen(buf) - 1] = '\0';
+
+        // Tokenize the line and populate the matrix
+        char *token = strtok(buf, " ");
+        while (token != NULL) { // Until the end
+            if (i < rows && j < cols) { // Ignore other values
+                matrix[i][j] = atoi(token); // Convert string to int
+                j++; // Next column
+            }
+            token = strtok(NULL, " "); // Last one
+        }
+
+        i++; // Next row
+        j = 0; // Reset column count for the new row
+    }
+    free(buf);
+}
+
+/*
+ * This function reads the rest of a Matrix Market (.mtx) file after readFile has read its header line
+ * Assumption: coordinate or array format, integer, real (cut to int) or pattern values, general, symmetric or
+ *             skew-symmetric. Indexes in the file start at 1, cells past rows x cols are ignored. Array
+ *             symmetric and skew-symmetric files hold only the lower triangle, a column at a time
+ * Input parameters: FILE *file, const char *header, int rows, int cols, int matrix[][cols]
+ * Returns: void, updates matrix by reference
+*/
+void readMatrixMarket(FILE *file, const char *header, int rows, int cols, int matrix[][cols]) {
+    char format[16] = "", field[16] = "", symmetry[16] = "";
+    long m = 0, n = 0, entries = 0;
+    sscanf(header, "%%%%MatrixMarket %*s %15s %15s %15s", format, field, symmetry);
+    int coordinate = strcmp(format, "coordinate") == 0;
+    int pattern = strcmp(field, "pattern") == 0;
+    int mirror = strcmp(symmetry, "general") == 0 ? 0 : strcmp(symmetry, "skew-symmetric") == 0 ? -1 : 1;
+
+    char *buf = malloc(LINE_SIZE);
+    // Next cell in array format, a column at a time. Symmetric files list only the lower triangle of each
+    // column and skew-symmetric ones leave out the diagonal too, so column j starts at row j or j + 1
+    long row = mirror < 0, col = 0;
+    while (fgets(buf, LINE_SIZE, file) != NULL) {
+        if (buf[0] == '%' || buf[strspn(buf, " \t\r\n")] == '\0')
+            continue; // Comments and blank lines
+        if (m == 0) {
+            if (sscanf(buf, "%ld %ld %ld", &m, &n, &entries) < 2)
+                break;
+            continue;
+        }
+
+        long i, j;
+        double value = 1;
+        if (coordinate) {
+            if (sscanf(buf, "%ld %ld %lf", &i, &j, &value) < (pattern ? 2 : 3))
+                continue;
+            i--;
+            j--;
+        } else {
+            if (sscanf(buf, "%lf", &value) != 1)
+                continue;
+            i = row;
+            j = col;
+            if (++row == m) {
+                col++;
+                row = mirror == 0 ? 0 : col + (mirror < 0);
+            }
+        }
+        if (i >= 0 && j >= 0 && i < rows && j < cols)
+            matrix[i][j] = (int) value;
+        if (mirror && i != j && j < rows && i < cols && i >= 0 && j >= 0)
+            matrix[j][i] = (int) value * mirror;
+    }
+    free(buf);
+}
+
+/*
+ * Utility function to print a product the same way matrixmult_multiwa -r does
+ * Assumption: you're passing a valid matrix
+ * Input parameters: int rows, int cols, int matrix[][cols], char name[]
+ * Returns: void, prints rows and columns of matrix with name
+*/
+void printArrayContents(int rows, int cols, int matrix[][cols], char name[]) {
+    size_t i, j;
+
+    // Print the matrix
+    fprintf(stdout, "%s=[\n", name);
+    for (i = 0; i < rows; i++) { // For each row
+        for (j = 0; j < cols; j++) { // For each column
+            if (matrix[i][j] < 10 && matrix[i][j] > 0)
+                fprintf(stdout, " "); // Print a space for single digits (for formatting
+            fprintf(stdout, "%d ", matrix[i][j]); // Print the value
+        }
+        fprintf(stdout, "\n"); // New line for each row
+    }
+    fprintf(stdout, "\n]\n");
+}
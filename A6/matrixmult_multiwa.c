@@ -50,8 +50,14 @@
     If you had your commands in a text file cmds.txt, you could also run the above with redirection or with a pipe:
     $ ./matrixmult_multiwa A1.txt W1.txt W2.txt W3.txt < cmds.txt
     $ cat cmds.txt | ./matrixmult_multiwa A1.txt W1.txt W2.txt W3.txt
+
+    Or keep the children running as a daemon and send the A files from any number of clients:
+    $ ./matrixmult_multiwa -d mm.sock A1.txt W1.txt W2.txt W3.txt &
+    $ ./matrixmult_client mm.sock < cmds.txt
+    $ kill %1
  */
 
+#define _GNU_SOURCE // pipe2, cpu_set_t
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -60,11 +66,179 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
+#include <linux/io_uring.h>
 
-#define SIZE 8
+#ifndef SIZE
+#define SIZE 8 // Build with -DSIZE=N for bigger matrices, matrixmult_threaded has to use the same N
+#endif
 #define READ_END 0
 #define WRITE_END 1
 #define MATRIX_SIZE sizeof(int) * SIZE * SIZE
+#define NAME_SIZE 100 // A filenames of 100 chars max, see 8) above
+#define STORE_PREALLOC (SIZE <= 64 ? 1024 : 16) // A matrices per W the result store has room for before a child grows it
+#define LOAD_DEPTH 8 // A files read ahead of the broadcast by default (-k)
+#define LINE_SIZE (SIZE * 12 + 2) // Longest line readFile takes, SIZE ints and their spaces
+#define LOAD_BUF_SIZE (SIZE * SIZE * 8 + 1024) // Bytes a load slot starts with, a longer A file grows it
+#define LOAD_MAX (64 << 20) // Largest A file the loader holds, a .mtx file can list its entries anywhere in it
+#define LINE_BUF_SIZE 4096 // stdin is read in chunks of this size, a line longer than this is cut
+#define REORDER_START 64 // Result sets the reorder buffer holds before it has to grow
+#define JOBSERVER_MAX 4096 // Tokens that fit in a pipe without blocking
+#define QUEUE_DEPTH 16 // Requests queued per child by default (-Q), on top of one page of pipe
+#define PARSED_CACHE_MB 16 // Parsed A files kept by the prefetch thread by default (-C), 0 turns it off
+#define DAEMON_OUT_MAX (64 * sizeof(serverReply)) // Bytes of replies queued for a client not reading, then it is cut off
+#define DAEMON_DRAIN_MS 1000 // How long a client has to read its last replies once the daemon is stopping
+#define STATUS_UNKNOWN -1 // Exit status of a zygote worker whose zygote exited before reporting it
+#define EVENT_DATA(kind, index) (((uint64_t) (kind) << 32) | (uint32_t) (index))
+
+enum { EVENT_PIDFD, EVENT_REQUEST, EVENT_PREFETCH, EVENT_ZYGOTE }; // What an epoll event in the main loop is for
+enum { POLICY_BLOCK, POLICY_DROP, POLICY_SHED }; // What happens to a new request when a child's queue is full
+enum { AFFINITY_NONE, AFFINITY_CORE, AFFINITY_NODE }; // What each child is pinned to
+enum { SPAWN_FORK, SPAWN_POSIX }; // How each child is started (-x)
+
+extern char **environ; // Passed on to posix_spawn with the child's own variables in front
+
+/*
+ * This structure is the part of a matrix its file really has, the rest of the SIZE x SIZE buffer is 0
+ * Assumption: Matches matrixShape in matrixmult_threaded.c, rows and cols are at most SIZE
+ * Input parameters: the number of rows and the widest row read
+ * Returns: Nothing
+*/
+struct matrixShape {
+    int rows;
+    int cols;
+} typedef matrixShape;
+
+/*
+ * This structure is one request sent down a child's pipe
+ * Assumption: At the default SIZE small enough (< PIPE_BUF) that each write to the pipe is atomic, only the
+ *             parent writes the pipe so a bigger -DSIZE request can go in several writes
+ * Input parameters: the request number, the A filename, its shape and the A matrix
+ * Returns: Nothing, the child logs name itself so its PID.out stays in order
+*/
+struct requestInfo {
+    int seq;
+    char name[NAME_SIZE];
+    matrixShape shape; // What the A file really has, the child only multiplies that part
+    int A[SIZE][SIZE];
+} typedef requestInfo;
+
+/*
+ * This structure is one product a child sends back on its result pipe (-r)
+ * Assumption: Matches resultInfo in matrixmult_threaded.c, one writer per pipe so it may take several writes
+ * Input parameters: the request number and the product
+ * Returns: Nothing
+*/
+struct resultInfo {
+    int seq;
+    int R[SIZE][SIZE];
+} typedef resultInfo;
+
+/*
+ * This structure is the header at the start of a result store file (-o)
+ * Assumption: Matches storeHeader in matrixmult_threaded.c and matrixmult_store.c. The numW W filenames,
+ *             NAME_SIZE chars each, follow it. Records start at dataOffset.
+ * Input parameters: the matrix size, the number of W files and the record layout
+ * Returns: Nothing
+*/
+struct storeHeader {
+    char magic[8];
+    int size;
+    int numW;
+    int recordSize;
+    int dataOffset;
+} typedef storeHeader;
+
+/*
+ * This structure asks the zygote (-z) for a child. The child's request pipe, and its result pipe with -r,
+ * go with it as SCM_RIGHTS, the zygote answers with the child's pid
+ * Assumption: Matches zygoteRequest in matrixmult_threaded.c
+ * Input parameters: the 1 based command number and the cpus to pin the child to
+ * Returns: Nothing
+*/
+struct zygoteRequest {
+    int command;
+    int pinned;
+    cpu_set_t cpus;
+    char cpuList[256]; // cpus as formatCpuList prints them, for the Pinned line
+} typedef zygoteRequest;
+
+/*
+ * This structure is read from the zygote's exit pipe each time one of its children exits, we cannot waitpid
+ * for processes we did not fork
+ * Assumption: Matches zygoteExit in matrixmult_threaded.c
+ * Input parameters: the child's pid and its status from waitpid
+ * Returns: Nothing
+*/
+struct zygoteExit {
+    pid_t pid;
+    int status;
+} typedef zygoteExit;
+
+/*
+ * This structure is one A matrix sent by a client in daemon mode (-d)
+ * Assumption: Matches clientRequest in matrixmult_client.c
+ * Input parameters: the client's own number for the request, the A filename and the A matrix
+ * Returns: Nothing, every W's product comes back as a serverReply with the same tag
+*/
+struct clientRequest {
+    int tag;
+    char name[NAME_SIZE];
+    int A[SIZE][SIZE];
+} typedef clientRequest;
+
+/*
+ * This structure is sent to a client once it connects, followed by numW W filenames of NAME_SIZE chars
+ * Assumption: Matches serverHello in matrixmult_client.c
+ * Input parameters: the matrix size and the number of W files
+ * Returns: Nothing
+*/
+struct serverHello {
+    char magic[8];
+    int size;
+    int numW;
+} typedef serverHello;
+
+/*
+ * This structure is one product sent back to a client, numW of them per request in W order
+ * Assumption: Matches serverReply in matrixmult_client.c
+ * Input parameters: the request's tag, the W number, the status and the product
+ * Returns: Nothing
+*/
+struct serverReply {
+    int tag;
+    int w;
+    int status; // REPLY_OK, REPLY_DROPPED or REPLY_NONE, R is only sent for REPLY_OK
+    int R[SIZE][SIZE];
+} typedef serverReply;
+
+enum { REPLY_OK, REPLY_DROPPED, REPLY_NONE }; // What a client gets for each W
+
+/*
+ * This structure is a request shared by every child queue it is waiting in
+ * Assumption: Freed when the last queue lets go of it
+ * Input parameters: the request and how many queues hold it
+ * Returns: Nothing
+*/
+struct queuedRequest {
+    requestInfo request;
+    int refs;
+} typedef queuedRequest;
 
 /*
  * This structure is used to store the pid information
@@ -75,54 +249,502 @@
 struct pidInfo {
     pid_t pid;
     int pipe[2];
+    int outFile; // PID.out, kept open by the parent until the child is reaped
+    int pidfd; // Readable once the child exits, -1 if the kernel has no pidfd_open
+    int alive;
+    int fromZygote; // Forked by the zygote, its exit comes on the zygote's exit pipe
+    int result[2]; // Products come back on this pipe with -r, READ_END is -1 without it
+    int index; // Position in pidArray, the W number
+    queuedRequest **queue; // Requests waiting for room in the pipe, at most queueDepth
+    int queueDepth;
+    int queueHead;
+    int queueCount;
+    size_t queueOffset; // Bytes of the oldest request already in the pipe, a big -DSIZE request takes several writes
+    int watchingOut; // EPOLLOUT is on for the pipe because the queue could not be written out
+    int depthMax; // Queue depth metric, sampled every time a request is queued
+    long depthSum;
+    long depthSamples;
+    int dropped;
+    int shed;
+    int pinned; // cpus is set, the child pins itself to it before exec
+    cpu_set_t cpus;
 } typedef pidInfo;
 
+/*
+ * This structure is the products of one A with every W, filled in as the children report
+ * Assumption: seq is -1 while the slot is not in use
+ * Input parameters: the request number, A filename and when it was sent
+ * Returns: Nothing
+*/
+struct resultSet {
+    int seq;
+    char name[NAME_SIZE];
+    int client; // Daemon client slot the set goes back to, -1 to print it to stdout
+    int tag; // The client's number for the request
+    struct timespec sent;
+    int received;
+    char *have; // have[i] is 1 once child i has reported, 2 if the request was never sent to it
+    int (*R)[SIZE][SIZE]; // R[i] is child i's product
+} typedef resultSet;
+
+/*
+ * This structure is one reply waiting to be sent to a client
+ * Assumption: Only the sender thread frees it, once all len bytes are out or the client is dead
+ * Input parameters: the next reply and the bytes of this one
+ * Returns: Nothing
+*/
+struct outgoingReply {
+    struct outgoingReply *next;
+    size_t len;
+    serverReply reply;
+} typedef outgoingReply;
+
+/*
+ * This structure is one client connection of the daemon
+ * Assumption: fd is -1 while the slot is free. Everything but partial is only touched under the reorder
+ *             buffer lock
+ * Input parameters: the socket
+ * Returns: Nothing
+*/
+struct daemonClient {
+    int fd;
+    int pending; // Requests handed to the children whose replies have not been queued yet
+    int eof; // The client is done sending, its socket is closed once pending is 0 and the queue is out
+    int dead; // Too far behind on its replies or the socket failed, it is cut off and gets nothing more
+    size_t got; // Bytes of partial read so far
+    clientRequest *partial;
+    outgoingReply *outHead; // Replies not sent yet, in order. The sender thread sends the head
+    outgoingReply *outTail;
+    size_t outBytes; // Bytes queued, at most DAEMON_OUT_MAX
+    size_t outSent; // Bytes of the head already sent
+} typedef daemonClient;
+
+/*
+ * This structure is the daemon (-d), a UNIX socket that takes A matrices from many clients in place of stdin
+ * Assumption: The clients array is only resized by the daemon thread, under the reorder buffer lock
+ * Input parameters: the socket path
+ * Returns: Nothing
+*/
+struct daemonServer {
+    const char *path;
+    int listenFd;
+    int sigFd; // SIGINT and SIGTERM stop the daemon
+    daemonClient *clients;
+    int capacity;
+    int sessions;
+    int requests;
+    char *const *wNames;
+    int numW;
+    pthread_t sender; // Sends the queued replies, so the collector never waits on a client
+    int wakeFd; // eventfd written when a reply is queued, a client dies or the daemon is stopping
+    int closing; // No more replies will be queued, the sender exits once the queues are out
+} typedef daemonServer;
+
+/*
+ * This structure is the reorder buffer, it prints complete result sets in request order (-r)
+ * Assumption: Requests are added by the broadcast loop before they are sent, results by the collector thread
+ * Input parameters: the children and their W filenames
+ * Returns: Nothing
+*/
+struct reorderBuffer {
+    resultSet *sets; // sets[seq % capacity]
+    int capacity;
+    int nextEmit; // Lowest seq not printed yet
+    int numChildren;
+    char *const *wNames;
+    pidInfo *pidArray;
+    daemonServer *server; // Sets from a daemon client go back to it instead of stdout, NULL without -d
+    char *childDone; // Result pipe at EOF, this child will not report anything else
+    int emitted;
+    double latencySum;
+    double latencyMax;
+    int epollFd;
+    pthread_mutex_t lock;
+    pthread_t thread;
+} typedef reorderBuffer;
+
+/*
+ * This structure is one A file being read by the loader
+ * Assumption: name is the path exactly as it was given on stdin
+ * Input parameters: the A filename
+ * Returns: Nothing, buf holds the whole file (len bytes) once state is LOAD_DONE, len < 0 and error on failure
+*/
+struct loadSlot {
+    char name[NAME_SIZE];
+    char *buf; // cap bytes, doubled while the file is longer
+    size_t cap;
+    ssize_t len;
+    int fd;
+    int state;
+    int error; // errno of a failed open or read, EFBIG past LOAD_MAX, ENAMETOOLONG for a name NAME_SIZE or longer
+} typedef loadSlot;
+
+enum { LOAD_FREE, LOAD_QUEUED, LOAD_OPENING, LOAD_READING, LOAD_DONE };
+
+/*
+ * This structure keeps up to depth A files being opened and read at once
+ * Assumption: Uses io_uring if the kernel has OPENAT and READ, otherwise depth plain threads
+ * Input parameters: the read ahead depth and which backend to try
+ * Returns: Nothing
+*/
+struct aLoader {
+    int depth;
+    loadSlot *slots;
+    int useUring;
+    // io_uring backend, unsubmitted counts SQEs in the ring the kernel has not taken yet
+    int ringFd;
+    unsigned unsubmitted;
+    void *sqRing, *cqRing, *sqeRing;
+    size_t sqRingSize, cqRingSize, sqeRingSize;
+    unsigned *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    // Thread backend, queue holds slot numbers waiting for a thread
+    pthread_t *threads;
+    int *queue;
+    int queueHead, queueCount, stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+} typedef aLoader;
+
+/*
+ * This structure reads stdin in chunks and hands out complete lines
+ * Assumption: Nothing else reads fd 0
+ * Input parameters: none
+ * Returns: Nothing
+*/
+struct lineReader {
+    char buf[LINE_BUF_SIZE];
+    size_t start;
+    size_t end;
+    int eof;
+} typedef lineReader;
+
+/*
+ * This structure is one parsed A file in the parsed cache, on its hash bucket's chain and on the LRU list
+ * Assumption: The file is only reused while its device, inode, mtime and size are the same
+ * Input parameters: the path as given on stdin, what stat said when it was read, and the parsed matrix
+ * Returns: Nothing
+*/
+struct parsedEntry {
+    char name[NAME_SIZE];
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    matrixShape shape;
+    int A[SIZE][SIZE];
+    struct parsedEntry *chain; // Next entry in the same bucket
+    struct parsedEntry *newer; // LRU list, most recently used at the head
+    struct parsedEntry *older;
+} typedef parsedEntry;
+
+/*
+ * This structure is the prefetch thread's cache of parsed A files, so a path that comes back on stdin costs a
+ * stat and a hash lookup instead of an open, a read and a parse
+ * Assumption: Only used by the prefetch thread
+ * Input parameters: the number of entries that fit in -C MB, the buckets and the counters
+ * Returns: Nothing
+*/
+struct parsedCache {
+    parsedEntry **buckets;
+    size_t numBuckets; // A power of 2
+    size_t capacity;
+    size_t count;
+    parsedEntry *newest;
+    parsedEntry *oldest;
+    long hits;
+    long misses;
+    long stale; // Misses on a path that was cached but has changed since
+} typedef parsedCache;
+
+/*
+ * This structure is the prefetch stage, a thread that reads stdin, loads and parses A files into a ring
+ * Assumption: One producer (the prefetch thread) and one consumer (the broadcast loop in main)
+ * Input parameters: the ring depth and loader backend
+ * Returns: Nothing
+*/
+struct prefetcher {
+    requestInfo *ready; // Parsed requests in stdin order
+    int *clients; // Daemon client slot and tag of each ready request, -1 for stdin
+    int *tags;
+    daemonServer *server; // Requests come from this daemon instead of stdin, NULL without -d
+    reorderBuffer *rb;
+    int depth;
+    int head;
+    int count;
+    int done; // Set once stdin is at EOF and everything loaded has been parsed
+    int seq; // Number of the next request parsed
+    int tryUring;
+    parsedCache *cache; // Parsed A files by path, NULL with -C 0
+    int notifyFd; // eventfd written whenever a request is ready or the stage is done
+    pthread_mutex_t lock;
+    pthread_cond_t notFull;
+    pthread_t thread;
+} typedef prefetcher;
+
 // Function prototypes
 int matrixMultParallel(char *const *wFiles, size_t n, pidInfo child);
+pid_t spawnChild(char *const *wFiles, size_t n, pidInfo child);
+pid_t zygoteStart(char *const *wFiles, int numChildren, int *sock, int *exitFd);
+pid_t zygoteFork(int sock, size_t n, pidInfo child);
+int zygoteReap(int exitFd, pidInfo *pidArray, int numChildren);
+int zygoteLost(int epollFd, pidInfo *pidArray, int numChildren);
 void checkFile(FILE *file, const char *filename);
-void readFile(FILE *file, int rows, int cols, int matrix[][cols]);
+void storeCreate(const char *path, char *const *wNames, int numW);
+void jobserverCreate(int tokens);
+int affinityFor(int mode, int n, int numChildren, cpu_set_t *set);
+int readCpuList(const char *path, cpu_set_t *set);
+void formatCpuList(const cpu_set_t *set, char *buf, size_t len);
+matrixShape readFile(FILE *file, int rows, int cols, int matrix[][cols]);
+matrixShape readMatrixMarket(FILE *file, const char *header, int rows, int cols, int matrix[][cols]);
+matrixShape shapeOf(int A[][SIZE]);
 void printArrayContents(int rows, int cols, int matrix[][cols], char name[]);
+void loaderStart(aLoader *loader, int depth, int tryUring);
+void loaderSubmit(aLoader *loader, int slot, const char *name);
+loadSlot *loaderWait(aLoader *loader, int slot);
+void loaderStop(aLoader *loader);
+int uringSetup(aLoader *loader);
+void uringPush(aLoader *loader, int opcode, int slot);
+void uringSubmit(aLoader *loader, int wait);
+void uringReap(aLoader *loader);
+int loadGrow(loadSlot *s);
+void* loaderThreadRun(void* givenLoader);
+char *nextLine(lineReader *reader);
+void fillLines(lineReader *reader);
+int stdinReady(void);
+void prefetchStart(prefetcher *pf, int depth, int tryUring, int firstSeq, daemonServer *server, reorderBuffer *rb,
+                   double cacheMb);
+int prefetchNext(prefetcher *pf, requestInfo *request, int *client, int *tag);
+void prefetchNotify(prefetcher *pf);
+void prefetchPush(prefetcher *pf, loadSlot *slot, int (*parsed)[SIZE], const matrixShape *shape,
+                  const struct stat *st);
+parsedCache *parsedOpen(double megabytes);
+parsedEntry *parsedFind(parsedCache *cache, const char *name, uint64_t hash);
+int parsedGet(parsedCache *cache, const char *name, const struct stat *st, int A[][SIZE], matrixShape *shape);
+void parsedPut(parsedCache *cache, const char *name, const struct stat *st, int A[][SIZE], matrixShape shape);
+void parsedClose(parsedCache *cache, int report);
+uint64_t nameHash(const char *name);
+void prefetchStop(prefetcher *pf);
+int pidfdOpen(pid_t pid);
+int reapChildren(pidInfo *pidArray, int numChildren, int block);
+int waitEvents(int epollFd, pidInfo *pidArray, int numChildren, int usePidfd, int notifyFd, int zygoteFd);
+void enqueueRequest(pidInfo *child, queuedRequest *queued, int policy, reorderBuffer *rb);
+void flushQueue(pidInfo *child, int epollFd);
+void releaseRequest(queuedRequest *queued);
+int queuesFull(pidInfo *pidArray, int numChildren);
+void finishChild(pidInfo *child, int status);
+void reorderStart(reorderBuffer *rb, pidInfo *pidArray, int numChildren, char *const *wNames);
+void reorderSubmit(reorderBuffer *rb, const requestInfo *request, int client, int tag);
+void reorderSkip(reorderBuffer *rb, int seq, int child);
+void reorderStop(reorderBuffer *rb);
+resultSet *reorderFind(reorderBuffer *rb, int seq);
+void reorderEmit(reorderBuffer *rb);
+void* collectorRun(void* givenBuffer);
+int readResult(int fd, resultInfo *result);
+void* prefetchRun(void* givenPrefetcher);
+int daemonListen(daemonServer *server, const char *path, char *const *wNames, int numW);
+void* daemonRun(void* givenPrefetcher);
+void daemonAccept(daemonServer *server, reorderBuffer *rb);
+int daemonRead(prefetcher *pf, int slot);
+void daemonReply(reorderBuffer *rb, resultSet *set);
+void daemonRelease(daemonServer *server, int slot);
+void* daemonSendRun(void* givenBuffer);
+int daemonSend(reorderBuffer *rb, int slot);
+void daemonDrop(daemonServer *server, int slot);
 
 int main(int argc, char* argv[]) {
     struct timespec start, finish;
     time_t elapsed;
-    char *line = NULL;  // For getline
-    size_t len = 0;  // For getlin
+    char *program = argv[0];
+    int opt;
+
+    // Options come before the files, children get them through the environment like PIPE in A4
+    char *storePath = NULL;
+    int loadDepth = LOAD_DEPTH;
+    int tryUring = 1;
+    int collect = 0;
+    int queueDepth = QUEUE_DEPTH;
+    int policy = POLICY_BLOCK;
+    int queueReport = 0; // The queue depth metric is printed only when -Q or -P tuned the queues
+    int tokens = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int affinity = AFFINITY_NONE;
+    int spawnMode = SPAWN_FORK;
+    int useZygote = 0;
+    char *daemonPath = NULL;
+    double cacheMb = PARSED_CACHE_MB;
+    int cacheReport = 0; // The hit rate is printed only when -C asked for the cache
+    while ((opt = getopt(argc, argv, "s:o:k:i:rQ:P:J:p:c:a:x:zd:b:m:C:DS:B:N:")) != -1) {
+        switch (opt) {
+            case 's': // Stream each product to PID.out as it is computed, flushed per the policy
+                setenv("STREAM", optarg, 1);
+                break;
+            case 'o': // Also write every product to a memory mapped result store
+                storePath = optarg;
+                setenv("STORE", optarg, 1);
+                break;
+            case 'k': // A files read ahead of the broadcast
+                loadDepth = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'i': // Loader backend, io_uring falls back to threads if the kernel does not support it
+                tryUring = strcmp(optarg, "threads") != 0;
+                break;
+            case 'r': // Children send products back, the parent prints each A x W1..Wn set in order
+                collect = 1;
+                break;
+            case 'Q': // Requests each child can have queued in the parent
+                queueDepth = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                queueReport = 1;
+                break;
+            case 'P': // What to do with a new request for a child whose queue is full
+                policy = strcmp(optarg, "drop") == 0 ? POLICY_DROP : strcmp(optarg, "shed") == 0 ? POLICY_SHED : POLICY_BLOCK;
+                queueReport = 1;
+                break;
+            case 'J': // Compute workers allowed to run at once across every child, 0 for no limit
+                tokens = atoi(optarg);
+                break;
+            case 'p': // Force serial, threaded or process products in the children, auto plans each one
+                setenv("POLICY", optarg, 1);
+                break;
+            case 'c': // Cost model profile, calibrated into the file the first time
+                setenv("PROFILE", optarg, 1);
+                break;
+            case 'a': // Pin each child to its own cores or NUMA node, its workers each to one of them
+                affinity = strcmp(optarg, "core") == 0 ? AFFINITY_CORE : strcmp(optarg, "node") == 0 ? AFFINITY_NODE : AFFINITY_NONE;
+                if (affinity != AFFINITY_NONE)
+                    setenv("AFFINITY", optarg, 1);
+                break;
+            case 'x': // Start children with fork then exec, or with posix_spawn which does not copy our page tables
+                spawnMode = strcmp(optarg, "spawn") == 0 ? SPAWN_POSIX : SPAWN_FORK;
+                break;
+            case 'z': // One zygote loads every W and calibrates once, then forks each child ready to compute
+                useZygote = 1;
+                break;
+            case 'd': // Take A matrices from clients on this UNIX socket instead of stdin, until SIGTERM
+                daemonPath = optarg;
+                collect = 1; // The products go back to the clients
+                break;
+            case 'b': // Children stack the As waiting for them into one product, up to N of them or M us
+                setenv("BATCH", optarg, 1);
+                break;
+            case 'm': // Children keep up to this many MB of products, an A seen before is not multiplied again
+                setenv("CACHE_MB", optarg, 1);
+                break;
+            case 'C': // MB of parsed A files kept by the parent, an unchanged file is not read and parsed again
+                cacheMb = atof(optarg);
+                cacheReport = 1;
+                break;
+            case 'D': // Children only multiply the rows of each A that differ from the A before
+                setenv("DELTA", "1", 1);
+                break;
+            case 'S': // Children keep W in CSR if at most this fraction of it is not 0, 0 never and 1 always
+                setenv("SPARSE", optarg, 1);
+                break;
+            case 'B': // 0 keeps a W of only 0 and 1 as it is, by default children pack it and use popcount
+                setenv("BITS", optarg, 1);
+                break;
+            case 'N': // 0 keeps int32, by default children multiply in int16 pairs when the values allow it
+                setenv("NARROW", optarg, 1);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s flushpolicy] [-o store] [-k depth] [-i uring|threads] "
+                                "[-r] [-Q depth] [-P block|drop|shed] [-J tokens] [-p serial|threaded|process|auto] [-c profile] "
+                                "[-a none|core|node] [-x fork|spawn] [-z] [-d socket] [-b batch] [-m MB] [-C MB] [-D] [-S density] [-B 0|1] [-N 0|1] A.txt W1.txt [W2.txt ...]\n", program);
+                return 1;
+        }
+    }
+    // Shift argv so argv[1] is A.txt and argv[2...] are the W files, as before options existed
+    argc -= optind - 1;
+    argv += optind - 1;
+    argv[0] = program;
+
+    // Check if > 2 args are provided
+    if (argc < 3) { // argv[0] is program name
+        printf("Error - expecting at least 2 files as input\n");
+        return 1;
+    }
+
     int numChildren = argc - 2;
     char **wFiles = malloc(sizeof(char *) * (numChildren + 1)); // A.txt stored, so +1
-    int A[SIZE][SIZE] = {0};
+    requestInfo *request = calloc(1, sizeof(requestInfo)); // On the heap since it gets big with -DSIZE
 
     // Open up A.txt which will be passed via pipes
     FILE *fileA = fopen(argv[1], "r");
     checkFile(fileA, argv[1]);
-    readFile(fileA, SIZE, SIZE, A);
+    request->shape = readFile(fileA, SIZE, SIZE, request->A);
     fclose(fileA);
+    snprintf(request->name, NAME_SIZE, "%s", argv[1]);
 
-    pidInfo pidArray[numChildren]; // Array of child pids for waitpid/writing to out files/status and parent > child pipe
+    // Array of child pids for waitpid/writing to out files/status and parent > child pipe, on the heap for big N
+    pidInfo *pidArray = malloc(sizeof(pidInfo) * numChildren);
+    int epollFd = epoll_create1(EPOLL_CLOEXEC); // Child pidfds, request pipes and the prefetch stage
+    int usePidfd = 1;
+    int alive = numChildren;
     clock_gettime(CLOCK_MONOTONIC, &start); // Start the clock
 
-    // Check if > 2 args are provided
-    if (argc < 3) { // argv[0] is program name
-        printf("Error - expecting at least 2 files as input\n");
-        return 1;
-    }
     // Copy argv[1] to wFiles[0].
-    wFiles[0] = malloc(sizeof(char) * strlen(argv[1]));
+    wFiles[0] = malloc(sizeof(char) * (strlen(argv[1]) + 1));
     strcpy(wFiles[0], argv[1]);
 
     // Copy W matrix filenames to wFiles array starting with argv[1] (argv[0] is program name)
     for (size_t i = 1; i < numChildren + 1; i++) { // +1 accounts for A.txt
-        wFiles[i] = malloc(sizeof(char) * strlen(argv[i + 1]));
+        wFiles[i] = malloc(sizeof(char) * (strlen(argv[i + 1]) + 1));
         strcpy(wFiles[i], argv[i + 1]);
     }
 
+    // Lay out the result store before any child maps it
+    if (storePath)
+        storeCreate(storePath, wFiles + 1, numChildren);
+
+    // Every child inherits the jobserver, so the 64 threads of each one share the same tokens
+    jobserverCreate(tokens);
+
+    // Listen before any child is started, so a bad socket path costs nothing
+    daemonServer server;
+    if (daemonPath && daemonListen(&server, daemonPath, wFiles + 1, numChildren) < 0) {
+        fprintf(stderr, "error: cannot listen on %s\n", daemonPath);
+        perror("bind");
+        return 1;
+    }
+
     // This loop spawns all the children and passes the initial A.txt to them
+    reorderBuffer rb;
+    if (collect)
+        reorderStart(&rb, pidArray, numChildren, wFiles + 1);
+    if (collect)
+        rb.server = daemonPath ? &server : NULL;
+    int zygoteSock = -1;
+    int zygoteFd = -1; // The zygote's exit pipe, -1 without -z
+    pid_t zygotePid = useZygote ? zygoteStart(argv, numChildren, &zygoteSock, &zygoteFd) : -1;
+    if (zygotePid > 0) {
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.u64 = EVENT_DATA(EVENT_ZYGOTE, 0);
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, zygoteFd, &event);
+    }
     for (size_t n = 0; n < numChildren; n++) {
         // Spawn a child process
         pidInfo child;
-        pipe(child.pipe);
-        pid_t pid = fork();
+        pipe2(child.pipe, O_CLOEXEC); // Later children must not hold this pipe open, dup2 clears it for stdin
+        child.result[READ_END] = child.result[WRITE_END] = -1;
+        child.index = (int) n;
+        child.pinned = affinityFor(affinity, (int) n, numChildren, &child.cpus);
+        if (collect)
+            pipe2(child.result, O_CLOEXEC);
+        if (collect && n == 0)
+            reorderSubmit(&rb, request, -1, 0);
+        pid_t pid = -1;
+        int fromZygote = 0;
+        if (zygoteSock >= 0)
+            fromZygote = (pid = zygoteFork(zygoteSock, n + 1, child)) > 0; // Its exit comes on zygoteFd
+        if (pid < 0 && spawnMode == SPAWN_POSIX)
+            pid = spawnChild(argv, n + 1, child); // -1 if it failed, fork then reports the error the usual way
+        if (pid < 0)
+            pid = fork();
         child.pid = pid;
+        child.fromZygote = fromZygote;
         pidArray[n] = child; // Store the pid
         // If parent, continue to next child
         if (pid < 0) {
@@ -132,79 +754,164 @@ int main(int argc, char* argv[]) {
         }
         // If parent, write to pipe then continue to next child
         if (pid != 0) {
-            // Write rSum to the pipe
-            write(pidArray[n].pipe[WRITE_END], A, MATRIX_SIZE);
+            // Open PID.out once for the Finished/Exited lines, O_CREAT since the child may not have yet
+            char filename[100];
+            sprintf(filename, "%d.out", pid);
+            pidArray[n].outFile = open(filename, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            pidArray[n].alive = 1;
+            close(pidArray[n].pipe[READ_END]);
+            if (collect)
+                close(pidArray[n].result[WRITE_END]);
+
+            // Watch the child's pidfd, the event says which child directly so there is no pid scan
+            struct epoll_event event = {0};
+            event.events = EPOLLIN;
+            event.data.u64 = EVENT_DATA(EVENT_PIDFD, n);
+            pidArray[n].pidfd = fromZygote ? -1 : pidfdOpen(pid);
+            if (!fromZygote && (pidArray[n].pidfd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, pidArray[n].pidfd, &event) < 0))
+                usePidfd = 0; // No pidfds, reapChildren falls back to waitpid
+
+            // Write the first request to the pipe
+            write(pidArray[n].pipe[WRITE_END], request, sizeof(requestInfo));
+
+            // From here on the pipe only holds one page, the rest waits in the parent's bounded queue
+            fcntl(pidArray[n].pipe[WRITE_END], F_SETPIPE_SZ, 4096);
+            fcntl(pidArray[n].pipe[WRITE_END], F_SETFL, O_NONBLOCK);
+            pidArray[n].queue = malloc(sizeof(queuedRequest *) * queueDepth);
+            pidArray[n].queueDepth = queueDepth;
+            pidArray[n].queueHead = pidArray[n].queueCount = 0;
+            pidArray[n].queueOffset = 0;
+            pidArray[n].watchingOut = 0;
+            pidArray[n].depthMax = pidArray[n].dropped = pidArray[n].shed = 0;
+            pidArray[n].depthSum = pidArray[n].depthSamples = 0;
+            event.events = 0; // EPOLLOUT is turned on only while the queue is backed up
+            event.data.u64 = EVENT_DATA(EVENT_REQUEST, n);
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, pidArray[n].pipe[WRITE_END], &event);
             continue;
         }
         // Child only code below here
         exit(matrixMultParallel(argv, n + 1, pidArray[n])); // Exit with the return code of the child function
     }
 
-    // This loop is within the parent and reads from stdin, writing to the pipes of all children
-    while (getline(&line, &len, stdin) > 0) {
-        char *token;  // For getline
-        if (line[strlen(line) - 1] == '\n') line[strlen(line) - 1] = '\0';
-        token = strtok(line, " "); // Strip whitespace, get the first token as a C-string
-        if(token) {
-            // Zero out A
-            memset(A, 0, MATRIX_SIZE);
+    // The zygote exits once its children have
+    if (zygoteSock >= 0)
+        close(zygoteSock);
+
+    // SIGINT and SIGTERM stop the daemon, they are read from a signalfd so no thread may take them
+    if (daemonPath) {
+        sigset_t stop;
+        sigemptyset(&stop);
+        sigaddset(&stop, SIGINT);
+        sigaddset(&stop, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop, NULL);
+        server.sigFd = signalfd(-1, &stop, SFD_CLOEXEC);
+    }
+
+    // The collector reads every result pipe on its own thread, so the children never wait on the loop below
+    if (collect)
+        pthread_create(&rb.thread, NULL, collectorRun, &rb);
+    if (daemonPath)
+        pthread_create(&server.sender, NULL, daemonSendRun, &rb);
 
-            // Open the file
-            FILE *newFileA = fopen(line, "r");
-            checkFile(newFileA, line);
-            readFile(newFileA, SIZE, SIZE, A);
-            fclose(newFileA);
+    prefetcher pf;
+    prefetchStart(&pf, loadDepth, tryUring, request->seq + 1, daemonPath ? &server : NULL, collect ? &rb : NULL,
+                  cacheMb);
+    free(request);
+    struct epoll_event prefetchEvent = {0};
+    prefetchEvent.events = EPOLLIN;
+    prefetchEvent.data.u64 = EVENT_DATA(EVENT_PREFETCH, 0);
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, pf.notifyFd, &prefetchEvent);
+    signal(SIGPIPE, SIG_IGN); // A child that died is reaped below, a write to its pipe must not kill us
 
-            // Write to every pipe in pidArray
+    /*
+     * This loop is within the parent and feeds the pipes of all children. Reading stdin and loading and
+     * parsing the next loadDepth A files happens on the prefetch thread, so this loop only hands off ready
+     * matrices. Each child has its own bounded queue and its pipe is never written to blocking, so a slow
+     * child only holds up the others if the policy is block.
+     */
+    int prefetchDone = 0;
+    while (1) {
+        // Take ready requests off the prefetch ring while the policy lets us
+        int ringEmpty = 0;
+        while (!prefetchDone && (policy != POLICY_BLOCK || !queuesFull(pidArray, numChildren))) {
+            // One copy of the request is shared by every queue, the child logs the filename to PID.out itself
+            queuedRequest *queued = malloc(sizeof(queuedRequest));
+            int client, tag;
+            int got = prefetchNext(&pf, &queued->request, &client, &tag);
+            if (got < 0)
+                prefetchDone = 1;
+            if (got == 0)
+                ringEmpty = 1;
+            if (got <= 0) {
+                free(queued);
+                break;
+            }
+            if (collect)
+                reorderSubmit(&rb, &queued->request, client, tag);
+            queued->refs = 1;
             for (size_t i = 0; i < numChildren; i++) {
-                // Append filename to the end of every child's .out file
-                char filename[100];
-                sprintf(filename, "%d.out", pidArray[i].pid);
-                int outFile = open(filename, O_RDWR | O_APPEND, 0777);
-                write(outFile, line, strlen(line));
-                close(outFile);
-
-                // Write to the pipe
-                write(pidArray[i].pipe[WRITE_END], A, MATRIX_SIZE);
+                if (pidArray[i].alive)
+                    enqueueRequest(&pidArray[i], queued, policy, collect ? &rb : NULL);
+            }
+            releaseRequest(queued);
+        }
+
+        // Write out what each pipe will take without blocking
+        int queued = 0;
+        for (size_t i = 0; i < numChildren; i++) {
+            if (pidArray[i].alive) {
+                flushQueue(&pidArray[i], epollFd);
+                queued += pidArray[i].queueCount;
             }
         }
+        if (prefetchDone && queued == 0)
+            break;
+        if (!prefetchDone && !ringEmpty && !queuesFull(pidArray, numChildren))
+            continue; // The pipes took the queues, more requests may already be in the ring
+
+        // Sleep until a pipe has room, a request is ready or a child exited (its Finished lines go out now)
+        alive -= waitEvents(epollFd, pidArray, numChildren, usePidfd, pf.notifyFd, zygoteFd);
     }
+    prefetchStop(&pf);
+    if (daemonPath)
+        fprintf(stdout, "Daemon: %d clients, %d requests\n", server.sessions, server.requests);
 
     // Close the write end of all the pipes
     for (size_t i = 0; i < numChildren; i++) {
-        close(pidArray[i].pipe[WRITE_END]);
+        if (pidArray[i].alive) {
+            close(pidArray[i].pipe[WRITE_END]);
+            pidArray[i].pipe[WRITE_END] = -1;
+        }
     }
 
     // wait for all children in pidArray and write Finished child xxxx pid of parent xxxx to child_pid.out
-    int currentChild;
-    int status;
-    while ((currentChild = wait(&status)) > 0) {
-    //for (size_t i = 0; i < numChildren; i++) {
-        // Get the right pid
-        int i = 0;
-        for (i = 0; i < numChildren; i++) {
-            if (pidArray[i].pid == currentChild)
-                break;
-        }
-
-        char filename[100];
-        sprintf(filename, "%d.out", pidArray[i].pid);
-        int outFile = open(filename, O_RDWR | O_APPEND, 0777);
-        char parentLine[100];
-        char exitLine[100];
-
-        // Handle exit codes and signals, buffer a string to write to file
-        sprintf(parentLine, "Finished child %d pid of parent %d\n", pidArray[i].pid, getpid());
-        if (WIFSIGNALED(status))
-            sprintf(exitLine, "Killed with signal %d\n", WTERMSIG(status));
-        else
-            sprintf(exitLine, "Exited with exitcode = %d\n", WEXITSTATUS(status));
-
+    while (alive > 0)
+        alive -= usePidfd || zygoteFd >= 0 ? waitEvents(epollFd, pidArray, numChildren, usePidfd, pf.notifyFd, zygoteFd)
+                                           : reapChildren(pidArray, numChildren, 1);
+    close(epollFd);
+    if (zygotePid > 0) {
+        waitpid(zygotePid, NULL, 0);
+        close(zygoteFd);
+    }
+    if (collect)
+        reorderStop(&rb);
+    if (daemonPath) {
+        close(server.wakeFd);
+        for (int i = 0; i < server.capacity; i++)
+            free(server.clients[i].partial);
+        free(server.clients);
+    }
+    if (pf.cache)
+        parsedClose(pf.cache, cacheReport);
 
-        //append to outfile
-        write(outFile, parentLine, strlen(parentLine));
-        write(outFile, exitLine, strlen(exitLine));
-        close(outFile);
+    // Queue depth metric, how far behind each child fell
+    for (size_t i = 0; i < numChildren; i++) {
+        if (queueReport)
+            fprintf(stdout, "Queue for %s: depth max %d avg %.2f, dropped %d, shed %d\n", wFiles[i + 1],
+                    pidArray[i].depthMax,
+                    pidArray[i].depthSamples ? (double) pidArray[i].depthSum / pidArray[i].depthSamples : 0.0,
+                    pidArray[i].dropped, pidArray[i].shed);
+        free(pidArray[i].queue);
     }
 
     clock_gettime(CLOCK_MONOTONIC, &finish);
@@ -218,7 +925,7 @@ int main(int argc, char* argv[]) {
         free(wFiles[i]);
     }
     free(wFiles);
-    free(line);
+    free(pidArray);
 
     return 0;
 }
@@ -253,9 +960,28 @@ int matrixMultParallel(char *const *wFiles, size_t n, pidInfo child) {
     close(newStdErr);
 
     fprintf(stdout, "Starting command %d: child %d pid of parent %d\n", (int) n, getpid(), getppid());
-    fprintf(stdout, "%s", wFiles[1]);
+
+    // Pin before exec, so W and every buffer matrixmult_threaded allocates are first touched on these cpus' node
+    if (child.pinned && sched_setaffinity(0, sizeof(cpu_set_t), &child.cpus) == 0) {
+        char cpuList[256];
+        formatCpuList(&child.cpus, cpuList, sizeof(cpuList));
+        fprintf(stdout, "Pinned to cpus %s\n", cpuList);
+    }
     fflush(stdout);
 
+    // Keep the result pipe open across exec and tell the child where it is, like PIPE in A4
+    if (child.result[WRITE_END] >= 0) {
+        char resultVar[20];
+        fcntl(child.result[WRITE_END], F_SETFD, 0);
+        sprintf(resultVar, "%d", child.result[WRITE_END]);
+        setenv("RESULT", resultVar, 1);
+    }
+
+    // Tell the child which column of the result store is its own
+    char storeIndex[20];
+    sprintf(storeIndex, "%d", (int) n - 1);
+    setenv("STORE_INDEX", storeIndex, 1);
+
     // create args and call with execvp
     char *args[] = {"./matrixmult_threaded", wFiles[0], wFiles[n + 1], NULL};
     execvp(args[0], args); // Execute the program
@@ -267,51 +993,2160 @@ int matrixMultParallel(char *const *wFiles, size_t n, pidInfo child) {
     return 1; // Will exit child with exit code 1
 }
 
+/*
+ * This function starts child n with posix_spawn instead of fork, so a parent with a lot of memory does not copy
+ * its page tables only to throw them away in exec. The redirections matrixMultParallel does after fork are
+ * file actions here. The PID is not known until the child exists, so its .out and .err are opened under a
+ * temporary name and renamed once posix_spawn returns. matrixmult_threaded prints the Starting line itself
+ * from COMMAND, and the Pinned line from PINNED.
+ * Assumption: Called from the spawn loop before any other thread of ours runs, it briefly pins this thread and
+ *             clears CLOEXEC on the result pipe
+ * Input parameters: char *const *wFiles, size_t n, pidInfo child
+ * Returns: pid_t of the child, or -1 if posix_spawn failed
+*/
+pid_t spawnChild(char *const *wFiles, size_t n, pidInfo child) {
+    char out[100];
+    char err[100];
+    sprintf(out, ".spawn.%d.%d.out", getpid(), (int) n);
+    sprintf(err, ".spawn.%d.%d.err", getpid(), (int) n);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, out, O_RDWR | O_CREAT | O_APPEND, 0666);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, err, O_RDWR | O_CREAT | O_APPEND, 0666);
+    posix_spawn_file_actions_adddup2(&actions, child.pipe[READ_END], STDIN_FILENO);
+
+    // The child's own variables go in front of ours, getenv finds the first one
+    char command[40], storeIndex[40], resultVar[40], pinnedVar[300];
+    size_t count = 0;
+    while (environ[count])
+        count++;
+    char **envp = malloc(sizeof(char *) * (count + 5));
+    size_t e = 0;
+    sprintf(command, "COMMAND=%d", (int) n);
+    envp[e++] = command;
+    sprintf(storeIndex, "STORE_INDEX=%d", (int) n - 1);
+    envp[e++] = storeIndex;
+    if (child.result[WRITE_END] >= 0) {
+        sprintf(resultVar, "RESULT=%d", child.result[WRITE_END]);
+        envp[e++] = resultVar;
+        fcntl(child.result[WRITE_END], F_SETFD, 0); // Only this child may inherit it, set back below
+    }
+
+    // posix_spawn has no affinity attribute, but the child inherits the mask of the thread that spawns it
+    cpu_set_t saved;
+    int pinned = child.pinned && sched_getaffinity(0, sizeof(saved), &saved) == 0 &&
+                 sched_setaffinity(0, sizeof(cpu_set_t), &child.cpus) == 0;
+    if (pinned) {
+        strcpy(pinnedVar, "PINNED=");
+        formatCpuList(&child.cpus, pinnedVar + 7, sizeof(pinnedVar) - 7);
+        envp[e++] = pinnedVar;
+    }
+    memcpy(envp + e, environ, sizeof(char *) * (count + 1));
+
+    pid_t pid;
+    char *args[] = {"./matrixmult_threaded", wFiles[0], wFiles[n + 1], NULL};
+    int failed = posix_spawn(&pid, args[0], &actions, NULL, args, envp);
+
+    if (pinned)
+        sched_setaffinity(0, sizeof(saved), &saved);
+    if (child.result[WRITE_END] >= 0)
+        fcntl(child.result[WRITE_END], F_SETFD, FD_CLOEXEC);
+    posix_spawn_file_actions_destroy(&actions);
+    free(envp);
+
+    if (failed) {
+        unlink(out);
+        unlink(err);
+        return -1;
+    }
+
+    // Still the same open files in the child, only the names change
+    char filename[100];
+    sprintf(filename, "%d.out", pid);
+    rename(out, filename);
+    sprintf(filename, "%d.err", pid);
+    rename(err, filename);
+    return pid;
+}
 
 /*
- * This function checks the file and prints errors if needed
- * Assumption: file is not null, there is a filename
- * Input parameters: FILE *file, const char *filename
- * Returns: void, exits if needed
+ * This function starts the zygote for -z: matrixmult_threaded with ZYGOTE set and every W file. It loads the
+ * Ws and its cost model once and then forks each child we ask zygoteFork for
+ * Assumption: Called before the spawn loop, after everything the children inherit through the environment is set
+ * Input parameters: char *const *wFiles (argv), int numChildren, int *sock, int *exitFd (set on success)
+ * Returns: pid_t of the zygote, or -1 if it could not be started and the children are forked as usual
 */
-void checkFile(FILE *file, const char *filename) {
-    if (file == NULL) { // If there is no file, or you can't access it
-        fprintf(stderr, "error: cannot open file %s\n", filename);
-        exit(1); // End the program here, do not return
+pid_t zygoteStart(char *const *wFiles, int numChildren, int *sock, int *exitFd) {
+    int pair[2];
+    int exitPipe[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0)
+        return -1;
+    if (pipe2(exitPipe, O_CLOEXEC) < 0) {
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Zygote only code below here, it keeps its ends of the socket and exit pipe across exec
+        char zygote[40];
+        fcntl(pair[1], F_SETFD, 0);
+        fcntl(exitPipe[WRITE_END], F_SETFD, 0);
+        sprintf(zygote, "%d,%d", pair[1], exitPipe[WRITE_END]);
+        setenv("ZYGOTE", zygote, 1);
+
+        // Same arguments as a child, with every W instead of one
+        char **args = malloc(sizeof(char *) * (numChildren + 3));
+        args[0] = "./matrixmult_threaded";
+        for (int i = 1; i <= numChildren + 1; i++)
+            args[i] = wFiles[i];
+        args[numChildren + 2] = NULL;
+        execvp(args[0], args);
+        perror("execvp");
+        _exit(1);
     }
+    close(pair[1]);
+    close(exitPipe[WRITE_END]);
+    if (pid < 0) {
+        close(pair[0]);
+        close(exitPipe[READ_END]);
+        return -1;
+    }
+    fcntl(exitPipe[READ_END], F_SETFL, O_NONBLOCK);
+    *sock = pair[0];
+    *exitFd = exitPipe[READ_END];
+    return pid;
 }
 
 /*
- * This function reads the file and populates the given matrix.
- * Assumption: file has been checked, matrix is already initialized, and rows and columns are known
- * Input parameters: FILE *file, int rows, int cols, int matrix[][cols]
- * Returns: void, updates matrix by reference
+ * This function asks the zygote for child n, handing it the child's request pipe and result pipe
+ * Assumption: sock came from zygoteStart
+ * Input parameters: int sock, size_t n, pidInfo child
+ * Returns: pid_t of the child, or -1 if the zygote did not start it
 */
-void readFile(FILE *file, int rows, int cols, int matrix[][cols]) {
-    // Initialize row and column counters
-    size_t i = 0;
-    size_t j = 0;
+pid_t zygoteFork(int sock, size_t n, pidInfo child) {
+    zygoteRequest ask = {0};
+    ask.command = (int) n;
+    ask.pinned = child.pinned;
+    if (child.pinned) {
+        ask.cpus = child.cpus;
+        formatCpuList(&child.cpus, ask.cpuList, sizeof(ask.cpuList));
+    }
 
-    // Read the file line by line
-    char buf[100];
-    while (fgets(buf, sizeof(buf), file) != NULL) {
+    int fds[2] = {child.pipe[READ_END], child.result[WRITE_END]};
+    int numFds = fds[1] >= 0 ? 2 : 1;
+    char control[CMSG_SPACE(sizeof(fds))] = {0};
+    struct iovec iov = {&ask, sizeof(ask)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * numFds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * numFds);
 
-        // Remove trailing newline character
-        if (buf[strlen(buf) - 1] == '\n') buf[strlen(buf) - 1] = '\0';
+    // The zygote answers with the pid once it has forked, that is the whole round trip
+    pid_t pid;
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0 || recv(sock, &pid, sizeof(pid), 0) != sizeof(pid))
+        return -1;
+    return pid;
+}
 
-        // Tokenize the line and populate the matrix
-        char *token = strtok(buf, " ");
-        while (token != NULL) { // Until tjhe end
-            if (i < rows && j < cols) { // Ignore other values
-                matrix[i][j] = atoi(token); // Convert string to int
-                j++; // Next column
+
+/*
+ * This function creates the result store: header, W filenames and STORE_PREALLOC records per W
+ * Assumption: Called before the children are forked, record (seq, w) is at dataOffset + (seq * numW + w) * recordSize
+ * Input parameters: const char *path, char *const *wNames, int numW
+ * Returns: void, exits if the store cannot be created
+*/
+void storeCreate(const char *path, char *const *wNames, int numW) {
+    storeHeader header = {0};
+    size_t recordSize = sizeof(int) * 2 + NAME_SIZE + MATRIX_SIZE; // storeRecord in matrixmult_threaded.c
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "error: cannot create result store %s\n", path);
+        exit(1);
+    }
+
+    memcpy(header.magic, "MMSTORE1", 8);
+    header.size = SIZE;
+    header.numW = numW;
+    header.recordSize = (int) recordSize;
+    header.dataOffset = (int) (((sizeof(header) + (size_t) numW * NAME_SIZE) + pageSize - 1) / pageSize * pageSize);
+
+    // Preallocate so the common case never grows the file, zeroed records read as not valid
+    if (posix_fallocate(fd, 0, header.dataOffset + (off_t) STORE_PREALLOC * numW * recordSize) != 0) {
+        fprintf(stderr, "error: cannot allocate result store %s\n", path);
+        exit(1);
+    }
+    pwrite(fd, &header, sizeof(header), 0);
+    for (int w = 0; w < numW; w++) {
+        char name[NAME_SIZE] = {0};
+        snprintf(name, NAME_SIZE, "%s", wNames[w]);
+        pwrite(fd, name, NAME_SIZE, sizeof(header) + (off_t) w * NAME_SIZE);
+    }
+    close(fd);
+}
+
+/*
+ * This function sets up the token jobserver shared by the whole process tree, like make's. The pipe holds
+ * one byte per compute worker allowed to run, a worker at any level reads a byte before computing and
+ * writes it back after. The fds are left open across exec and passed down in JOBSERVER, like PIPE in A4.
+ * Assumption: Called before any child is spawned
+ * Input parameters: int tokens (0 turns it off)
+ * Returns: void, a JOBSERVER already in the environment (from a parent up the tree) is kept as is
+*/
+void jobserverCreate(int tokens) {
+    int fds[2];
+    char value[32];
+    char token = '+';
+
+    if (tokens <= 0 || getenv("JOBSERVER") || pipe(fds) < 0)
+        return;
+    if (tokens > JOBSERVER_MAX)
+        tokens = JOBSERVER_MAX; // All of them have to fit in the pipe at once
+    for (int i = 0; i < tokens; i++)
+        write(fds[WRITE_END], &token, 1);
+
+    snprintf(value, sizeof(value), "%d,%d", fds[READ_END], fds[WRITE_END]);
+    setenv("JOBSERVER", value, 1);
+}
+
+/*
+ * This function picks the cpus child n is pinned to. With core each child gets its own share of the cpus the
+ * parent may run on, with node the children are spread round robin over the NUMA nodes
+ * Assumption: Called by the parent before forking child n
+ * Input parameters: int mode, int n, int numChildren, cpu_set_t *set
+ * Returns: int (1) if set was filled in, (0) to leave the child unpinned
+*/
+int affinityFor(int mode, int n, int numChildren, cpu_set_t *set) {
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int count = 0;
+
+    if (mode == AFFINITY_NONE || sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed))
+            cpus[count++] = cpu;
+    }
+    CPU_ZERO(set);
+
+    if (mode == AFFINITY_NODE) {
+        // Count the nodes, a machine without /sys/devices/system/node is one node
+        char path[100];
+        int nodes = 0;
+        while (1) {
+            sprintf(path, "/sys/devices/system/node/node%d/cpulist", nodes);
+            if (access(path, R_OK) != 0)
+                break;
+            nodes++;
+        }
+        if (nodes > 0) {
+            sprintf(path, "/sys/devices/system/node/node%d/cpulist", n % nodes);
+            if (readCpuList(path, set)) {
+                CPU_AND(set, set, &allowed);
+                if (CPU_COUNT(set) > 0)
+                    return 1;
             }
-            token = strtok(NULL, " "); // Last one
         }
+        *set = allowed;
+        return 1;
+    }
 
-        i++; // Next row
-        j = 0; // Reset column count for the new row
+    // AFFINITY_CORE, neighbouring cpus so a child's workers share as much cache as they can
+    int share = count / numChildren > 0 ? count / numChildren : 1;
+    int first = (n * share) % count;
+    for (int i = 0; i < share; i++)
+        CPU_SET(cpus[(first + i) % count], set);
+    return 1;
+}
+
+/*
+ * This function reads a cpu list like 0-3,8-11 from sysfs
+ * Assumption: set has been zeroed
+ * Input parameters: const char *path, cpu_set_t *set
+ * Returns: int (1) if the file could be read
+*/
+int readCpuList(const char *path, cpu_set_t *set) {
+    FILE *file = fopen(path, "r");
+    int first, last;
+    char sep;
+    if (!file)
+        return 0;
+
+    while (fscanf(file, "%d", &first) == 1) {
+        last = first;
+        sep = (char) fgetc(file);
+        if (sep == '-') {
+            if (fscanf(file, "%d", &last) != 1)
+                break;
+            sep = (char) fgetc(file);
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, set);
+        if (sep != ',')
+            break;
+    }
+    fclose(file);
+    return 1;
+}
+
+/*
+ * This function writes a cpu set as a list like 0-3,8-11
+ * Assumption: buf has room for len chars
+ * Input parameters: const cpu_set_t *set, char *buf, size_t len
+ * Returns: void, fills buf by reference
+*/
+void formatCpuList(const cpu_set_t *set, char *buf, size_t len) {
+    size_t used = 0;
+    buf[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE && used < len; cpu++) {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+        if (last == cpu)
+            used += snprintf(buf + used, len - used, "%s%d", used ? "," : "", cpu);
+        else
+            used += snprintf(buf + used, len - used, "%s%d-%d", used ? "," : "", cpu, last);
+        cpu = last;
+    }
+}
+
+/*
+ * This function opens a pidfd for a child, it becomes readable when the child exits
+ * Assumption: pid is our child
+ * Input parameters: pid_t pid
+ * Returns: int the pidfd, or -1 if the kernel does not have pidfd_open
+*/
+int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    return -1;
+#endif
+}
+
+/*
+ * This function reaps children with waitpid, for kernels without pidfds
+ * Assumption: Only used when the pidfds could not be set up
+ * Input parameters: pidInfo *pidArray, int numChildren, int block (wait for at least one)
+ * Returns: int the number of children reaped
+*/
+int reapChildren(pidInfo *pidArray, int numChildren, int block) {
+    int reaped = 0;
+    int status;
+
+    // wait() for anything and find the child by pid
+    pid_t currentChild;
+    while ((currentChild = waitpid(-1, &status, block && !reaped ? 0 : WNOHANG)) > 0) {
+        for (int i = 0; i < numChildren; i++) {
+            if (pidArray[i].pid == currentChild && pidArray[i].alive) {
+                finishChild(&pidArray[i], status);
+                reaped++;
+                break;
+            }
+        }
+    }
+    return reaped;
+}
+
+/*
+ * This function waits for the main loop's events and handles them: a child exited, a pipe has room again
+ * or the prefetch stage has a request ready
+ * Assumption: epollFd has the pidfds (if usePidfd), request pipes, prefetch eventfd and zygote exit pipe
+ * Input parameters: int epollFd, pidInfo *pidArray, int numChildren, int usePidfd, int notifyFd (prefetch),
+ *                   int zygoteFd (-1 without -z)
+ * Returns: int the number of children reaped
+*/
+int waitEvents(int epollFd, pidInfo *pidArray, int numChildren, int usePidfd, int notifyFd, int zygoteFd) {
+    struct epoll_event events[16];
+    int reaped = 0;
+    int status;
+    uint64_t count;
+
+    // Without pidfds an exit does not wake us up, so poll for them every 100 ms
+    int ready = epoll_wait(epollFd, events, 16, usePidfd ? -1 : 100);
+    for (int e = 0; e < ready; e++) {
+        int kind = (int) (events[e].data.u64 >> 32);
+        pidInfo *child = &pidArray[(uint32_t) events[e].data.u64];
+
+        if (kind == EVENT_PIDFD && child->alive) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, child->pidfd, NULL);
+            if (waitpid(child->pid, &status, 0) < 0) // Already exited, does not block
+                status = STATUS_UNKNOWN; // A zygote worker left behind by its zygote is not ours to wait for
+            finishChild(child, status);
+            reaped++;
+        } else if (kind == EVENT_REQUEST && child->alive) {
+            flushQueue(child, epollFd);
+        } else if (kind == EVENT_PREFETCH) {
+            read(notifyFd, &count, sizeof(count)); // Just a wakeup, the loop checks the ring itself
+        } else if (kind == EVENT_ZYGOTE) {
+            int finished = zygoteReap(zygoteFd, pidArray, numChildren);
+            if (finished < 0) {
+                // The zygote is gone, nothing more comes on its pipe. Its workers still running are watched
+                // with pidfds from here on, the rest are finished now
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, zygoteFd, NULL);
+                reaped += zygoteLost(epollFd, pidArray, numChildren);
+            } else {
+                reaped += finished;
+            }
+        }
+    }
+
+    if (!usePidfd)
+        reaped += reapChildren(pidArray, numChildren, 0);
+    return reaped;
+}
+
+/*
+ * This function reads the zygote's exit pipe and finishes every child it reports
+ * Assumption: exitFd is O_NONBLOCK
+ * Input parameters: int exitFd, pidInfo *pidArray, int numChildren
+ * Returns: int the number of children finished, (-1) once the zygote has exited
+*/
+int zygoteReap(int exitFd, pidInfo *pidArray, int numChildren) {
+    zygoteExit exited;
+    ssize_t got;
+    int reaped = 0;
+
+    while ((got = read(exitFd, &exited, sizeof(exited))) == sizeof(exited)) {
+        for (int i = 0; i < numChildren; i++) {
+            if (pidArray[i].pid == exited.pid && pidArray[i].alive) {
+                finishChild(&pidArray[i], exited.status);
+                reaped++;
+                break;
+            }
+        }
+    }
+    return got == 0 && reaped == 0 ? -1 : reaped;
+}
+
+/*
+ * This function takes over the children of a zygote that exited without reporting all of them. Each one that
+ * is still running gets a pidfd in the main loop's epoll, its exit status is unknown since it is not our child
+ * Assumption: The zygote's exit pipe is at EOF
+ * Input parameters: int epollFd, pidInfo *pidArray, int numChildren
+ * Returns: int the number of children finished now (already gone, or no pidfds to watch them with)
+*/
+int zygoteLost(int epollFd, pidInfo *pidArray, int numChildren) {
+    int reaped = 0;
+    for (int i = 0; i < numChildren; i++) {
+        pidInfo *child = &pidArray[i];
+        if (!child->alive || !child->fromZygote || child->pidfd >= 0)
+            continue;
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.u64 = EVENT_DATA(EVENT_PIDFD, i);
+        child->pidfd = pidfdOpen(child->pid);
+        if (child->pidfd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, child->pidfd, &event) == 0)
+            continue;
+        finishChild(child, STATUS_UNKNOWN);
+        reaped++;
+    }
+    return reaped;
+}
+
+/*
+ * This function queues a request for a child, applying the policy if its queue is full
+ * Assumption: With POLICY_BLOCK the caller has already made sure the queue has room
+ * Input parameters: pidInfo *child, queuedRequest *queued, int policy, reorderBuffer *rb (NULL without -r)
+ * Returns: void, updates the child's queue depth metric
+*/
+void enqueueRequest(pidInfo *child, queuedRequest *queued, int policy, reorderBuffer *rb) {
+    if (child->queueCount == child->queueDepth) {
+        if (policy == POLICY_SHED && child->queueOffset == 0) {
+            // Make room by throwing away the oldest request this child has not been sent yet
+            queuedRequest *oldest = child->queue[child->queueHead];
+            child->queueHead = (child->queueHead + 1) % child->queueDepth;
+            child->queueCount--;
+            child->shed++;
+            if (rb)
+                reorderSkip(rb, oldest->request.seq, child->index);
+            releaseRequest(oldest);
+        } else {
+            // Drop (or block, which should not get here) the new request for this child only. Shed drops it too
+            // if the oldest one is already half way into the pipe
+            child->dropped++;
+            if (rb)
+                reorderSkip(rb, queued->request.seq, child->index);
+            queued = NULL;
+        }
+    }
+
+    if (queued) {
+        child->queue[(child->queueHead + child->queueCount) % child->queueDepth] = queued;
+        child->queueCount++;
+        queued->refs++;
+    }
+
+    child->depthSum += child->queueCount;
+    child->depthSamples++;
+    if (child->queueCount > child->depthMax)
+        child->depthMax = child->queueCount;
+}
+
+/*
+ * This function writes queued requests to a child's pipe until it is empty or the pipe is full
+ * Assumption: The pipe is O_NONBLOCK. A request < PIPE_BUF goes in whole or not at all, a bigger one is
+ *             written in parts and queueOffset says how far it got
+ * Input parameters: pidInfo *child, int epollFd
+ * Returns: void, turns EPOLLOUT on for the pipe while requests are left over
+*/
+void flushQueue(pidInfo *child, int epollFd) {
+    while (child->queueCount > 0) {
+        queuedRequest *queued = child->queue[child->queueHead];
+        ssize_t written = write(child->pipe[WRITE_END], (char *) &queued->request + child->queueOffset,
+                                sizeof(requestInfo) - child->queueOffset);
+        if (written < 0) {
+            if (errno == EAGAIN)
+                break;
+            // The child is gone (EPIPE), it gets reaped through its pidfd, nothing else is sent to it
+            while (child->queueCount > 0) {
+                releaseRequest(child->queue[child->queueHead]);
+                child->queueHead = (child->queueHead + 1) % child->queueDepth;
+                child->queueCount--;
+            }
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, child->pipe[WRITE_END], NULL);
+            child->queueOffset = 0;
+            return;
+        }
+        child->queueOffset += written;
+        if (child->queueOffset < sizeof(requestInfo))
+            continue; // Only part of a big request went in, the next write may block
+        child->queueOffset = 0;
+        child->queueHead = (child->queueHead + 1) % child->queueDepth;
+        child->queueCount--;
+        releaseRequest(queued);
+    }
+
+    int wantOut = child->queueCount > 0;
+    if (wantOut != child->watchingOut) {
+        struct epoll_event event = {0};
+        event.events = wantOut ? EPOLLOUT : 0;
+        event.data.u64 = EVENT_DATA(EVENT_REQUEST, child->index);
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, child->pipe[WRITE_END], &event);
+        child->watchingOut = wantOut;
+    }
+}
+
+/*
+ * This function lets go of a queued request, freeing it once nothing holds it
+ * Assumption: queued came from the broadcast loop
+ * Input parameters: queuedRequest *queued
+ * Returns: void
+*/
+void releaseRequest(queuedRequest *queued) {
+    if (--queued->refs == 0)
+        free(queued);
+}
+
+/*
+ * This function checks if any live child's queue is full, for the block policy
+ * Assumption: none
+ * Input parameters: pidInfo *pidArray, int numChildren
+ * Returns: int (1) if some queue is full
+*/
+int queuesFull(pidInfo *pidArray, int numChildren) {
+    for (int i = 0; i < numChildren; i++) {
+        if (pidArray[i].alive && pidArray[i].queueCount == pidArray[i].queueDepth)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * This function appends the Finished and Exited (or Killed) lines to a reaped child's PID.out
+ * Assumption: The child has been reaped
+ * Input parameters: pidInfo *child, int status from waitpid
+ * Returns: void, closes everything the parent had open for the child
+*/
+void finishChild(pidInfo *child, int status) {
+    char parentLine[100];
+    char exitLine[100];
+
+    // Handle exit codes and signals, buffer a string to write to file
+    sprintf(parentLine, "Finished child %d pid of parent %d\n", child->pid, getpid());
+    if (status == STATUS_UNKNOWN)
+        sprintf(exitLine, "Exit status unknown, the zygote exited first\n");
+    else if (WIFSIGNALED(status))
+        sprintf(exitLine, "Killed with signal %d\n", WTERMSIG(status));
+    else
+        sprintf(exitLine, "Exited with exitcode = %d\n", WEXITSTATUS(status));
+
+
+    //append both lines to outfile in one writev
+    struct iovec lines[2] = {
+        {parentLine, strlen(parentLine)},
+        {exitLine, strlen(exitLine)}
+    };
+    writev(child->outFile, lines, 2);
+    close(child->outFile);
+
+    // Nothing more goes to this child, the pipe is closed here if the child died before EOF
+    if (child->pipe[WRITE_END] >= 0)
+        close(child->pipe[WRITE_END]);
+    while (child->queueCount > 0) {
+        releaseRequest(child->queue[child->queueHead]);
+        child->queueHead = (child->queueHead + 1) % child->queueDepth;
+        child->queueCount--;
+    }
+    if (child->pidfd >= 0)
+        close(child->pidfd);
+    child->alive = 0;
+}
+
+/*
+ * This function sets up the reorder buffer and the collector's epoll set
+ * Assumption: Called before the children are forked, the collector thread is started after
+ * Input parameters: reorderBuffer *rb, pidInfo *pidArray, int numChildren, char *const *wNames
+ * Returns: void
+*/
+void reorderStart(reorderBuffer *rb, pidInfo *pidArray, int numChildren, char *const *wNames) {
+    memset(rb, 0, sizeof(reorderBuffer));
+    rb->capacity = REORDER_START;
+    rb->sets = calloc(rb->capacity, sizeof(resultSet));
+    for (int i = 0; i < rb->capacity; i++) {
+        rb->sets[i].seq = -1;
+        rb->sets[i].have = calloc(numChildren, sizeof(char));
+        rb->sets[i].R = malloc(sizeof(int[SIZE][SIZE]) * numChildren);
+    }
+    rb->numChildren = numChildren;
+    rb->wNames = wNames;
+    rb->pidArray = pidArray;
+    rb->childDone = calloc(numChildren, sizeof(char));
+    rb->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    pthread_mutex_init(&rb->lock, NULL);
+}
+
+/*
+ * This function adds a request to the reorder buffer before it is sent, doubling the buffer if it is full
+ * Assumption: Requests are submitted in seq order
+ * Input parameters: reorderBuffer *rb, const requestInfo *request, int client (daemon slot, -1 for stdin),
+ *                   int tag (the client's number for it)
+ * Returns: void
+*/
+void reorderSubmit(reorderBuffer *rb, const requestInfo *request, int client, int tag) {
+    pthread_mutex_lock(&rb->lock);
+    if (request->seq - rb->nextEmit >= rb->capacity) {
+        // Move the sets still waiting into a buffer twice the size, keyed by seq the same way
+        int newCapacity = rb->capacity * 2;
+        resultSet *sets = calloc(newCapacity, sizeof(resultSet));
+        for (int i = 0; i < rb->capacity; i++) {
+            if (rb->sets[i].seq >= 0)
+                sets[rb->sets[i].seq % newCapacity] = rb->sets[i];
+        }
+        for (int i = 0; i < rb->capacity; i++) {
+            if (rb->sets[i].seq < 0) {
+                free(rb->sets[i].have);
+                free(rb->sets[i].R);
+            }
+        }
+        for (int i = 0; i < newCapacity; i++) {
+            if (sets[i].have == NULL) {
+                sets[i].seq = -1;
+                sets[i].have = calloc(rb->numChildren, sizeof(char));
+                sets[i].R = malloc(sizeof(int[SIZE][SIZE]) * rb->numChildren);
+            }
+        }
+        free(rb->sets);
+        rb->sets = sets;
+        rb->capacity = newCapacity;
+    }
+
+    resultSet *set = &rb->sets[request->seq % rb->capacity];
+    set->seq = request->seq;
+    set->client = client;
+    set->tag = tag;
+    snprintf(set->name, NAME_SIZE, "%s", request->name);
+    clock_gettime(CLOCK_MONOTONIC, &set->sent);
+    set->received = 0;
+    memset(set->have, 0, rb->numChildren);
+    pthread_mutex_unlock(&rb->lock);
+}
+
+/*
+ * This function marks a request as never sent to a child, so its set does not wait for that product
+ * Assumption: Called by the broadcast loop after reorderSubmit for seq
+ * Input parameters: reorderBuffer *rb, int seq, int child
+ * Returns: void, prints any sets that are now complete
+*/
+void reorderSkip(reorderBuffer *rb, int seq, int child) {
+    pthread_mutex_lock(&rb->lock);
+    resultSet *set = reorderFind(rb, seq);
+    if (set && !set->have[child]) {
+        set->have[child] = 2;
+        reorderEmit(rb);
+    }
+    pthread_mutex_unlock(&rb->lock);
+}
+
+/*
+ * This function waits for the collector (and the daemon's sender) to finish and prints the latency summary
+ * Assumption: Every child has exited, so every result pipe is at EOF
+ * Input parameters: reorderBuffer *rb
+ * Returns: void, frees the buffer
+*/
+void reorderStop(reorderBuffer *rb) {
+    pthread_join(rb->thread, NULL);
+
+    // Every reply is queued now, the daemon's sender exits once the clients have taken them
+    if (rb->server) {
+        pthread_mutex_lock(&rb->lock);
+        rb->server->closing = 1;
+        pthread_mutex_unlock(&rb->lock);
+        uint64_t one = 1;
+        write(rb->server->wakeFd, &one, sizeof(one));
+        pthread_join(rb->server->sender, NULL);
+    }
+
+    if (rb->emitted)
+        fprintf(stdout, "Result sets: %d, latency avg %.3f ms, max %.3f ms\n", rb->emitted,
+                rb->latencySum / rb->emitted, rb->latencyMax);
+
+    for (int i = 0; i < rb->capacity; i++) {
+        free(rb->sets[i].have);
+        free(rb->sets[i].R);
+    }
+    free(rb->sets);
+    free(rb->childDone);
+    close(rb->epollFd);
+    pthread_mutex_destroy(&rb->lock);
+}
+
+/*
+ * This function finds the result set for a request
+ * Assumption: rb->lock is held
+ * Input parameters: reorderBuffer *rb, int seq
+ * Returns: resultSet*, or NULL if seq is not waiting in the buffer
+*/
+resultSet *reorderFind(reorderBuffer *rb, int seq) {
+    resultSet *set = &rb->sets[seq % rb->capacity];
+    return set->seq == seq ? set : NULL;
+}
+
+/*
+ * This function prints every complete result set at the front of the buffer, in request order. A set is
+ * complete when every child has reported it or will never report anything again (died or exited)
+ * Assumption: rb->lock is held
+ * Input parameters: reorderBuffer *rb
+ * Returns: void
+*/
+void reorderEmit(reorderBuffer *rb) {
+    resultSet *set;
+    while ((set = reorderFind(rb, rb->nextEmit)) != NULL) {
+        for (int i = 0; i < rb->numChildren; i++) {
+            if (!set->have[i] && !rb->childDone[i])
+                return;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double latency = (now.tv_sec - set->sent.tv_sec) * 1000.0 + (now.tv_nsec - set->sent.tv_nsec) / 1000000.0;
+        rb->latencySum += latency;
+        rb->latencyMax = latency > rb->latencyMax ? latency : rb->latencyMax;
+        rb->emitted++;
+
+        if (set->client >= 0) {
+            // A daemon client's request, the products go back to it and only the latency is logged here
+            fprintf(stdout, "Request %d: %s from client %d, latency %.3f ms\n", set->seq, set->name, set->client, latency);
+            daemonReply(rb, set);
+            set->seq = -1;
+            rb->nextEmit++;
+            continue;
+        }
+
+        fprintf(stdout, "Request %d: %s, latency %.3f ms\n", set->seq, set->name, latency);
+        for (int i = 0; i < rb->numChildren; i++) {
+            char name[2 * NAME_SIZE + 4];
+            snprintf(name, sizeof(name), "%s x %s", set->name, rb->wNames[i]);
+            if (set->have[i] == 1)
+                printArrayContents(SIZE, SIZE, set->R[i], name);
+            else if (set->have[i] == 2)
+                fprintf(stdout, "%s: dropped, child %d was too far behind\n", name, rb->pidArray[i].pid);
+            else
+                fprintf(stdout, "%s: no result, child %d exited\n", name, rb->pidArray[i].pid);
+        }
+        fflush(stdout);
+
+        set->seq = -1;
+        rb->nextEmit++;
+    }
+}
+
+/*
+ * This function reads one whole product off a result pipe, a big -DSIZE product takes several reads
+ * Assumption: fd is the blocking read end of a result pipe and has data (or EOF)
+ * Input parameters: int fd, resultInfo *result
+ * Returns: int (1) with result filled in, (0) at EOF
+*/
+int readResult(int fd, resultInfo *result) {
+    size_t got = 0;
+    while (got < sizeof(resultInfo)) {
+        ssize_t n = read(fd, (char *) result + got, sizeof(resultInfo) - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        got += n;
+    }
+    return 1;
+}
+
+/*
+ * This function is the collector thread, it reads the products off every result pipe as they arrive
+ * Assumption: To be ran as a thread, started after every child has been forked
+ * Input parameters: void* givenBuffer (a reorderBuffer)
+ * Returns: NULL once every result pipe is at EOF
+*/
+void* collectorRun(void* givenBuffer) {
+    reorderBuffer *rb = (reorderBuffer*) givenBuffer;
+    resultInfo *result = malloc(sizeof(resultInfo)); // On the heap since it gets big with -DSIZE
+    int open = 0;
+
+    for (int i = 0; i < rb->numChildren; i++) {
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl(rb->epollFd, EPOLL_CTL_ADD, rb->pidArray[i].result[READ_END], &event);
+        open++;
+    }
+
+    while (open > 0) {
+        struct epoll_event events[16];
+        int ready = epoll_wait(rb->epollFd, events, 16, -1);
+        for (int e = 0; e < ready; e++) {
+            int i = events[e].data.u32;
+            int fd = rb->pidArray[i].result[READ_END];
+
+            pthread_mutex_lock(&rb->lock);
+            if (readResult(fd, result)) {
+                resultSet *set = reorderFind(rb, result->seq);
+                if (set && !set->have[i]) {
+                    memcpy(set->R[i], result->R, sizeof(result->R));
+                    set->have[i] = 1;
+                    set->received++;
+                }
+            } else {
+                // EOF, the child exited. Sets it never answered can be printed without it now
+                epoll_ctl(rb->epollFd, EPOLL_CTL_DEL, fd, NULL);
+                close(fd);
+                rb->childDone[i] = 1;
+                open--;
+            }
+            reorderEmit(rb);
+            pthread_mutex_unlock(&rb->lock);
+        }
+    }
+    free(result);
+    return NULL;
+}
+
+/*
+ * This function starts the prefetch thread, or the daemon thread that takes requests from clients instead
+ * Assumption: depth > 0, server has a listening socket, rb is only needed with a server
+ * Input parameters: prefetcher *pf, int depth, int tryUring, int firstSeq (number of the first stdin A),
+ *                   daemonServer *server (NULL to read stdin), reorderBuffer *rb, double cacheMb (for parsedOpen)
+ * Returns: void
+*/
+void prefetchStart(prefetcher *pf, int depth, int tryUring, int firstSeq, daemonServer *server, reorderBuffer *rb,
+                   double cacheMb) {
+    pf->ready = malloc(sizeof(requestInfo) * depth);
+    pf->clients = malloc(sizeof(int) * depth);
+    pf->tags = malloc(sizeof(int) * depth);
+    pf->server = server;
+    pf->rb = rb;
+    pf->depth = depth;
+    pf->head = 0;
+    pf->count = 0;
+    pf->done = 0;
+    pf->seq = firstSeq;
+    pf->tryUring = tryUring;
+    pf->cache = server ? NULL : parsedOpen(cacheMb); // Clients send matrices, there are no files to cache
+    pf->notifyFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->notFull, NULL);
+    pthread_create(&pf->thread, NULL, server ? daemonRun : prefetchRun, pf);
+}
+
+/*
+ * This function takes the next parsed request off the ring without waiting for one
+ * Assumption: Only called by the broadcast loop, which sleeps on notifyFd
+ * Input parameters: prefetcher *pf, requestInfo *request, int *client, int *tag (who sent it, -1 for stdin)
+ * Returns: int (1) with request filled in, (0) if none is ready yet, (-1) once stdin is done and the ring is empty
+*/
+int prefetchNext(prefetcher *pf, requestInfo *request, int *client, int *tag) {
+    pthread_mutex_lock(&pf->lock);
+    if (pf->count == 0) {
+        int done = pf->done;
+        pthread_mutex_unlock(&pf->lock);
+        return done ? -1 : 0;
+    }
+
+    *request = pf->ready[pf->head];
+    *client = pf->clients[pf->head];
+    *tag = pf->tags[pf->head];
+    pf->head = (pf->head + 1) % pf->depth;
+    pf->count--;
+    pthread_cond_signal(&pf->notFull);
+    pthread_mutex_unlock(&pf->lock);
+    return 1;
+}
+
+/*
+ * This function parses a loaded A file straight into the next free slot of the ring, or copies it from the
+ * parsed cache
+ * Assumption: Only called by the prefetch thread, slot is LOAD_DONE unless parsed is given
+ * Input parameters: prefetcher *pf, loadSlot *slot, int (*parsed)[SIZE] and const matrixShape *shape (the cached
+ *                   matrix, NULL to parse slot), const struct stat *st (the file when it was submitted, NULL to
+ *                   not cache it)
+ * Returns: void, blocks while depth parsed requests are waiting to be broadcast, exits on a bad file
+*/
+void prefetchPush(prefetcher *pf, loadSlot *slot, int (*parsed)[SIZE], const matrixShape *shape,
+                  const struct stat *st) {
+    FILE *newFileA = NULL;
+    if (!parsed) {
+        if (slot->len < 0 && slot->error == EFBIG) {
+            fprintf(stderr, "error: cannot open file %s: larger than %d bytes\n", slot->name, LOAD_MAX);
+            exit(1);
+        }
+        if (slot->len < 0 && slot->error) {
+            fprintf(stderr, "error: cannot open file %s: %s\n", slot->name, strerror(slot->error));
+            exit(1);
+        }
+        newFileA = slot->len < 0 ? NULL : fmemopen(slot->buf, slot->len > 0 ? slot->len : 1, "r");
+        checkFile(newFileA, slot->name);
+    }
+
+    pthread_mutex_lock(&pf->lock);
+    while (pf->count == pf->depth)
+        pthread_cond_wait(&pf->notFull, &pf->lock);
+    requestInfo *request = &pf->ready[(pf->head + pf->count) % pf->depth];
+    pf->clients[(pf->head + pf->count) % pf->depth] = -1;
+    pthread_mutex_unlock(&pf->lock);
+
+    // The slot is ours until count goes up, so parse without holding the lock
+    memset(request, 0, sizeof(requestInfo));
+    if (parsed) {
+        memcpy(request->A, parsed, MATRIX_SIZE);
+        request->shape = *shape;
+    } else {
+        if (slot->len > 0)
+            request->shape = readFile(newFileA, SIZE, SIZE, request->A);
+        fclose(newFileA);
+        if (pf->cache && st)
+            parsedPut(pf->cache, slot->name, st, request->A, request->shape);
+    }
+    request->seq = pf->seq++;
+    snprintf(request->name, NAME_SIZE, "%s", slot->name);
+
+    pthread_mutex_lock(&pf->lock);
+    pf->count++;
+    pthread_mutex_unlock(&pf->lock);
+    prefetchNotify(pf);
+}
+
+/*
+ * This function wakes the broadcast loop up through the eventfd
+ * Assumption: notifyFd is non-blocking, a wakeup that is already pending is enough
+ * Input parameters: prefetcher *pf
+ * Returns: void
+*/
+void prefetchNotify(prefetcher *pf) {
+    uint64_t one = 1;
+    write(pf->notifyFd, &one, sizeof(one));
+}
+
+/*
+ * This function joins the prefetch thread and frees the ring, the parsed cache is left for parsedClose
+ * Assumption: prefetchNext has returned -1
+ * Input parameters: prefetcher *pf
+ * Returns: void
+*/
+void prefetchStop(prefetcher *pf) {
+    pthread_join(pf->thread, NULL);
+    close(pf->notifyFd);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->notFull);
+    free(pf->ready);
+    free(pf->clients);
+    free(pf->tags);
+}
+
+/*
+ * This function is the prefetch thread. Up to depth A files are opened and read at once by the loader,
+ * slots are used in stdin order so the broadcast order does not change. Stdin is only read ahead while
+ * it has data, so an interactive user still gets each A broadcast as soon as it is typed.
+ * Assumption: To be ran as a thread, the only reader of stdin
+ * Input parameters: void* givenPrefetcher (a prefetcher)
+ * Returns: NULL at EOF
+*/
+void* prefetchRun(void* givenPrefetcher) {
+    prefetcher *pf = (prefetcher*) givenPrefetcher;
+    aLoader loader;
+    lineReader reader = {0};
+    char *line;
+    int head = 0; // Oldest slot in flight
+    int inFlight = 0;
+    loaderStart(&loader, pf->depth, pf->tryUring);
+
+    // A slot whose file was in the parsed cache is not given to the loader, its matrix waits here instead.
+    // stats[slot] is the file when it was submitted, it goes in the cache with the parsed matrix
+    int *hit = calloc(pf->depth, sizeof(int));
+    int *statted = calloc(pf->depth, sizeof(int));
+    int (*parsed)[SIZE][SIZE] = pf->cache ? malloc(MATRIX_SIZE * pf->depth) : NULL;
+    matrixShape *shapes = malloc(sizeof(matrixShape) * pf->depth);
+    struct stat *stats = malloc(sizeof(struct stat) * pf->depth);
+
+    while (1) {
+        while (inFlight < pf->depth) {
+            if ((line = nextLine(&reader)) != NULL) {
+                char *token = strtok(line, " "); // Strip whitespace, get the first token as a C-string
+                if (token) {
+                    int slot = (head + inFlight) % pf->depth;
+                    statted[slot] = pf->cache && stat(token, &stats[slot]) == 0;
+                    hit[slot] = statted[slot] && parsedGet(pf->cache, token, &stats[slot], parsed[slot], &shapes[slot]);
+                    if (hit[slot])
+                        snprintf(loader.slots[slot].name, NAME_SIZE, "%s", token);
+                    else
+                        loaderSubmit(&loader, slot, token);
+                    inFlight++;
+                }
+                continue;
+            }
+            if (reader.eof) break;
+            if (inFlight > 0 && !stdinReady()) break; // Don't block on stdin while there is work
+            fillLines(&reader);
+        }
+        if (inFlight == 0) break; // EOF and everything is parsed
+
+        if (hit[head]) {
+            prefetchPush(pf, &loader.slots[head], parsed[head], &shapes[head], NULL);
+        } else {
+            loadSlot *slot = loaderWait(&loader, head);
+            prefetchPush(pf, slot, NULL, NULL, statted[head] ? &stats[head] : NULL);
+            slot->state = LOAD_FREE;
+        }
+        head = (head + 1) % pf->depth;
+        inFlight--;
+    }
+    loaderStop(&loader);
+    free(hit);
+    free(statted);
+    free(parsed);
+    free(shapes);
+    free(stats);
+
+    pthread_mutex_lock(&pf->lock);
+    pf->done = 1;
+    pthread_mutex_unlock(&pf->lock);
+    prefetchNotify(pf);
+    return NULL;
+}
+
+/*
+ * This function creates the parsed cache with as many entries as fit in the given number of MB
+ * Assumption: Less than one entry means no cache
+ * Input parameters: double megabytes
+ * Returns: parsedCache *, NULL if there is no cache
+*/
+parsedCache *parsedOpen(double megabytes) {
+    size_t capacity = megabytes > 0 ? (size_t) (megabytes * 1024 * 1024) / sizeof(parsedEntry) : 0;
+    if (capacity == 0)
+        return NULL;
+
+    parsedCache *cache = calloc(1, sizeof(parsedCache));
+    cache->capacity = capacity;
+    cache->numBuckets = 1;
+    while (cache->numBuckets < capacity && cache->numBuckets < 65536) // The buckets are allocated up front
+        cache->numBuckets *= 2;
+    cache->buckets = calloc(cache->numBuckets, sizeof(parsedEntry *));
+    return cache;
+}
+
+/*
+ * This function hashes a path with 64 bit FNV-1a
+ * Assumption: name is a C-string
+ * Input parameters: const char *name
+ * Returns: uint64_t
+*/
+uint64_t nameHash(const char *name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *) name; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * This function finds the entry for a path
+ * Assumption: hash is nameHash(name)
+ * Input parameters: parsedCache *cache, const char *name, uint64_t hash
+ * Returns: parsedEntry *, NULL if the path is not cached
+*/
+parsedEntry *parsedFind(parsedCache *cache, const char *name, uint64_t hash) {
+    parsedEntry *entry = cache->buckets[hash & (cache->numBuckets - 1)];
+    while (entry && strncmp(entry->name, name, NAME_SIZE) != 0)
+        entry = entry->chain;
+    return entry;
+}
+
+/*
+ * This function looks a path up and copies its matrix out if the file has not changed since it was parsed
+ * Assumption: st is what stat says about the path now
+ * Input parameters: parsedCache *cache, const char *name, const struct stat *st, int A[][SIZE], matrixShape *shape
+ * Returns: int (1) on a hit with A and shape filled in, (0) if the file has to be read
+*/
+int parsedGet(parsedCache *cache, const char *name, const struct stat *st, int A[][SIZE], matrixShape *shape) {
+    parsedEntry *entry = parsedFind(cache, name, nameHash(name));
+    if (!entry || entry->dev != st->st_dev || entry->ino != st->st_ino || entry->size != st->st_size ||
+        entry->mtime.tv_sec != st->st_mtim.tv_sec || entry->mtime.tv_nsec != st->st_mtim.tv_nsec) {
+        cache->misses++;
+        if (entry)
+            cache->stale++;
+        return 0;
+    }
+
+    // Move it to the head of the LRU list
+    if (entry != cache->newest) {
+        entry->newer->older = entry->older;
+        if (entry->older)
+            entry->older->newer = entry->newer;
+        else
+            cache->oldest = entry->newer;
+        entry->newer = NULL;
+        entry->older = cache->newest;
+        cache->newest->newer = entry;
+        cache->newest = entry;
+    }
+
+    memcpy(A, entry->A, MATRIX_SIZE);
+    *shape = entry->shape;
+    cache->hits++;
+    return 1;
+}
+
+/*
+ * This function caches a parsed A file, replacing what was cached for the path or the least recently used
+ * entry if the cache is full
+ * Assumption: st is what stat said before the file was read, so a file changed while it was read is stale
+ * Input parameters: parsedCache *cache, const char *name, const struct stat *st, int A[][SIZE], matrixShape shape
+ * Returns: void
+*/
+void parsedPut(parsedCache *cache, const char *name, const struct stat *st, int A[][SIZE], matrixShape shape) {
+    uint64_t hash = nameHash(name);
+    parsedEntry *entry = parsedFind(cache, name, hash);
+
+    if (!entry && cache->count < cache->capacity) {
+        entry = calloc(1, sizeof(parsedEntry));
+        snprintf(entry->name, NAME_SIZE, "%s", name);
+        parsedEntry **bucket = &cache->buckets[hash & (cache->numBuckets - 1)];
+        entry->chain = *bucket;
+        *bucket = entry;
+        cache->count++;
+    } else if (!entry) {
+        // Reuse the oldest entry, move it to its new bucket
+        entry = cache->oldest;
+        parsedEntry **link = &cache->buckets[nameHash(entry->name) & (cache->numBuckets - 1)];
+        while (*link != entry)
+            link = &(*link)->chain;
+        *link = entry->chain;
+        snprintf(entry->name, NAME_SIZE, "%s", name);
+        parsedEntry **bucket = &cache->buckets[hash & (cache->numBuckets - 1)];
+        entry->chain = *bucket;
+        *bucket = entry;
+    }
+
+    // Take it off the LRU list if it is on it, then put it at the head
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    else if (cache->newest == entry)
+        cache->newest = entry->older;
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    else if (cache->oldest == entry)
+        cache->oldest = entry->newer;
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest)
+        cache->newest->newer = entry;
+    else
+        cache->oldest = entry;
+    cache->newest = entry;
+
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->mtime = st->st_mtim;
+    entry->size = st->st_size;
+    entry->shape = shape;
+    memcpy(entry->A, A, MATRIX_SIZE);
+}
+
+/*
+ * This function prints the hit rate of the parsed cache if asked to and frees it
+ * Assumption: The prefetch thread is done and the collector has printed every result
+ * Input parameters: parsedCache *cache, int report
+ * Returns: void
+*/
+void parsedClose(parsedCache *cache, int report) {
+    long lookups = cache->hits + cache->misses;
+    if (report)
+        fprintf(stdout, "A cache: %ld hits of %ld (%.1f%%), %ld changed files read again, %zu of %zu entries used\n",
+                cache->hits, lookups, lookups ? 100.0 * cache->hits / lookups : 0.0, cache->stale, cache->count,
+                cache->capacity);
+
+    parsedEntry *entry = cache->newest;
+    while (entry) {
+        parsedEntry *older = entry->older;
+        free(entry);
+        entry = older;
+    }
+    free(cache->buckets);
+    free(cache);
+}
+
+/*
+ * This function opens the daemon's UNIX socket, replacing a socket file left over from an earlier daemon
+ * Assumption: Called before the children are started, the socket is not inherited by them
+ * Input parameters: daemonServer *server, const char *path, char *const *wNames, int numW
+ * Returns: int (0) on success, (-1) if the socket cannot be bound
+*/
+int daemonListen(daemonServer *server, const char *path, char *const *wNames, int numW) {
+    struct sockaddr_un addr = {0};
+    memset(server, 0, sizeof(daemonServer));
+    server->path = path;
+    server->sigFd = -1;
+    server->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    server->wNames = wNames;
+    server->numW = numW;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    server->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (server->listenFd < 0 || bind(server->listenFd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(server->listenFd, 64) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * This function is the daemon thread, it takes the place of the prefetch thread with -d. It accepts clients
+ * and reads their requests into the same ring, so the broadcast loop does not know where they came from.
+ * Many clients share the one set of children and Ws. SIGINT or SIGTERM stop it: no new clients or requests
+ * are taken, the ones already sent still get their replies.
+ * Assumption: pf->server is listening and has its signalfd
+ * Input parameters: void* givenPrefetcher
+ * Returns: void*, NULL
+*/
+void* daemonRun(void* givenPrefetcher) {
+    prefetcher *pf = (prefetcher*) givenPrefetcher;
+    daemonServer *server = pf->server;
+    struct pollfd *fds = NULL;
+    int *slots = NULL;
+    int running = 1;
+
+    while (running) {
+        // Poll the signalfd, the listening socket and every client still sending
+        fds = realloc(fds, sizeof(struct pollfd) * (server->capacity + 2));
+        slots = realloc(slots, sizeof(int) * (server->capacity + 2));
+        int numFds = 0;
+        fds[numFds++] = (struct pollfd) {server->sigFd, POLLIN, 0};
+        fds[numFds++] = (struct pollfd) {server->listenFd, POLLIN, 0};
+        for (int i = 0; i < server->capacity; i++) {
+            if (server->clients[i].fd >= 0 && !server->clients[i].eof) {
+                slots[numFds] = i;
+                fds[numFds++] = (struct pollfd) {server->clients[i].fd, POLLIN, 0};
+            }
+        }
+        if (poll(fds, numFds, -1) < 0)
+            continue; // EINTR
+
+        if (fds[0].revents & POLLIN)
+            running = 0;
+        if (running && (fds[1].revents & POLLIN))
+            daemonAccept(server, pf->rb);
+        for (int f = 2; running && f < numFds; f++) {
+            if (fds[f].revents && !daemonRead(pf, slots[f])) {
+                // The client is done sending, it is closed once its last reply is out
+                pthread_mutex_lock(&pf->rb->lock);
+                server->clients[slots[f]].eof = 1;
+                daemonRelease(server, slots[f]);
+                pthread_mutex_unlock(&pf->rb->lock);
+            }
+        }
+    }
+    close(server->listenFd);
+    close(server->sigFd);
+    unlink(server->path);
+    free(fds);
+    free(slots);
+
+    // Clients still connected get the replies already on their way, then see EOF
+    pthread_mutex_lock(&pf->rb->lock);
+    for (int i = 0; i < server->capacity; i++) {
+        if (server->clients[i].fd >= 0) {
+            server->clients[i].eof = 1;
+            daemonRelease(server, i);
+        }
+    }
+    pthread_mutex_unlock(&pf->rb->lock);
+
+    pthread_mutex_lock(&pf->lock);
+    pf->done = 1;
+    pthread_mutex_unlock(&pf->lock);
+    prefetchNotify(pf);
+    return NULL;
+}
+
+/*
+ * This function accepts a client and sends it the hello: the matrix size and the W filenames
+ * Assumption: Only called by the daemon thread
+ * Input parameters: daemonServer *server, reorderBuffer *rb
+ * Returns: void, the client gets a free slot, the slot array grows if there is none
+*/
+void daemonAccept(daemonServer *server, reorderBuffer *rb) {
+    int fd = accept4(server->listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    serverHello hello = {"MMDAEMON", SIZE, server->numW};
+    int ok = write(fd, &hello, sizeof(hello)) == sizeof(hello);
+    for (int i = 0; ok && i < server->numW; i++) {
+        char name[NAME_SIZE] = {0};
+        snprintf(name, NAME_SIZE, "%s", server->wNames[i]);
+        ok = write(fd, name, NAME_SIZE) == NAME_SIZE;
+    }
+    if (!ok) {
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK); // Requests are read a piece at a time, replies go out on the sender thread
+
+    pthread_mutex_lock(&rb->lock);
+    int slot;
+    for (slot = 0; slot < server->capacity; slot++) {
+        if (server->clients[slot].fd < 0)
+            break;
+    }
+    if (slot == server->capacity) {
+        server->capacity = server->capacity ? server->capacity * 2 : 16;
+        server->clients = realloc(server->clients, sizeof(daemonClient) * server->capacity);
+        for (int i = slot; i < server->capacity; i++) {
+            server->clients[i].fd = -1;
+            server->clients[i].partial = NULL;
+            server->clients[i].outHead = server->clients[i].outTail = NULL;
+        }
+    }
+    daemonClient *client = &server->clients[slot];
+    client->fd = fd;
+    client->pending = client->eof = client->dead = 0;
+    client->got = 0;
+    client->outBytes = client->outSent = 0;
+    if (!client->partial)
+        client->partial = malloc(sizeof(clientRequest));
+    server->sessions++;
+    pthread_mutex_unlock(&rb->lock);
+}
+
+/*
+ * This function reads what a client has sent. Every complete request goes into the ring like a parsed
+ * stdin A, tagged with the client's slot
+ * Assumption: Only called by the daemon thread, the client's socket is O_NONBLOCK
+ * Input parameters: prefetcher *pf, int slot
+ * Returns: int (1) if the client may send more, (0) at EOF or on an error
+*/
+int daemonRead(prefetcher *pf, int slot) {
+    daemonClient *client = &pf->server->clients[slot];
+    while (1) {
+        ssize_t n = read(client->fd, (char *) client->partial + client->got, sizeof(clientRequest) - client->got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return 1;
+        if (n <= 0)
+            return 0;
+        client->got += n;
+        if (client->got < sizeof(clientRequest))
+            continue;
+        client->got = 0;
+
+        // Waits while depth requests are ready, which holds every client back the same way -P block does
+        pthread_mutex_lock(&pf->lock);
+        while (pf->count == pf->depth)
+            pthread_cond_wait(&pf->notFull, &pf->lock);
+        int ring = (pf->head + pf->count) % pf->depth;
+        requestInfo *request = &pf->ready[ring];
+        request->seq = pf->seq++;
+        memcpy(request->name, client->partial->name, NAME_SIZE);
+        request->name[NAME_SIZE - 1] = '\0';
+        memcpy(request->A, client->partial->A, sizeof(request->A));
+        request->shape = shapeOf(request->A); // A client sends no file, padding is whatever is 0 at the end
+        pf->clients[ring] = slot;
+        pf->tags[ring] = client->partial->tag;
+        pf->count++;
+        pthread_mutex_unlock(&pf->lock);
+
+        pthread_mutex_lock(&pf->rb->lock);
+        client->pending++;
+        pf->server->requests++;
+        pthread_mutex_unlock(&pf->rb->lock);
+        prefetchNotify(pf);
+    }
+}
+
+/*
+ * This function queues a finished result set for the client that asked for it, one reply per W. The sender
+ * thread sends it, so a client that does not read its replies holds up no one
+ * Assumption: Called by reorderEmit with the reorder buffer lock held
+ * Input parameters: reorderBuffer *rb, resultSet *set
+ * Returns: void, a client with more than DAEMON_OUT_MAX bytes waiting is marked dead and cut off
+*/
+void daemonReply(reorderBuffer *rb, resultSet *set) {
+    daemonServer *server = rb->server;
+    daemonClient *client = &server->clients[set->client];
+    for (int i = 0; i < rb->numChildren && !client->dead; i++) {
+        outgoingReply *out = malloc(sizeof(outgoingReply));
+        out->next = NULL;
+        out->reply.tag = set->tag;
+        out->reply.w = i;
+        out->reply.status = set->have[i] == 1 ? REPLY_OK : set->have[i] == 2 ? REPLY_DROPPED : REPLY_NONE;
+        if (out->reply.status == REPLY_OK)
+            memcpy(out->reply.R, set->R[i], sizeof(out->reply.R));
+        out->len = out->reply.status == REPLY_OK ? sizeof(serverReply) : offsetof(serverReply, R);
+
+        if (client->outBytes + out->len > DAEMON_OUT_MAX) {
+            free(out);
+            client->dead = 1;
+            fprintf(stderr, "error: client %d is not reading its replies, disconnecting it\n", set->client);
+            break;
+        }
+        if (client->outTail)
+            client->outTail->next = out;
+        else
+            client->outHead = out;
+        client->outTail = out;
+        client->outBytes += out->len;
+    }
+    client->pending--;
+    daemonRelease(server, set->client);
+
+    uint64_t one = 1;
+    write(server->wakeFd, &one, sizeof(one));
+}
+
+/*
+ * This function closes a client once it is done sending and every reply it is owed has gone out
+ * Assumption: The reorder buffer lock is held
+ * Input parameters: daemonServer *server, int slot
+ * Returns: void, the slot can be reused by the next client
+*/
+void daemonRelease(daemonServer *server, int slot) {
+    daemonClient *client = &server->clients[slot];
+    if (client->eof && client->pending == 0 && !client->outHead && client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+}
+
+/*
+ * This function is the sender thread of the daemon. It writes each client's queued replies whenever its
+ * socket has room, and cuts off the clients marked dead
+ * Assumption: To be ran as a thread once the daemon is listening. Stops after closing is set and every queue
+ *             is out, or nothing moved for DAEMON_DRAIN_MS
+ * Input parameters: void* givenBuffer (a reorderBuffer)
+ * Returns: void*, NULL
+*/
+void* daemonSendRun(void* givenBuffer) {
+    reorderBuffer *rb = (reorderBuffer*) givenBuffer;
+    daemonServer *server = rb->server;
+    struct pollfd *fds = NULL;
+    int *slots = NULL;
+
+    while (1) {
+        // Poll the eventfd and every client with replies waiting
+        pthread_mutex_lock(&rb->lock);
+        fds = realloc(fds, sizeof(struct pollfd) * (server->capacity + 1));
+        slots = realloc(slots, sizeof(int) * (server->capacity + 1));
+        int numFds = 0;
+        fds[numFds++] = (struct pollfd) {server->wakeFd, POLLIN, 0};
+        for (int i = 0; i < server->capacity; i++) {
+            if (server->clients[i].fd < 0)
+                continue;
+            if (server->clients[i].dead) {
+                daemonDrop(server, i);
+                continue;
+            }
+            if (server->clients[i].outHead) {
+                slots[numFds] = i;
+                fds[numFds++] = (struct pollfd) {server->clients[i].fd, POLLOUT, 0};
+            }
+        }
+        int closing = server->closing;
+        pthread_mutex_unlock(&rb->lock);
+        if (closing && numFds == 1)
+            break;
+
+        int ready = poll(fds, numFds, closing ? DAEMON_DRAIN_MS : -1);
+        if (ready < 0)
+            continue; // EINTR
+        if (ready == 0)
+            break; // Stopping and the clients left are not reading, they are closed below
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            read(server->wakeFd, &count, sizeof(count));
+        }
+        for (int f = 1; f < numFds; f++) {
+            if (fds[f].revents && !daemonSend(rb, slots[f])) {
+                pthread_mutex_lock(&rb->lock);
+                server->clients[slots[f]].dead = 1;
+                pthread_mutex_unlock(&rb->lock);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&rb->lock);
+    for (int i = 0; i < server->capacity; i++) {
+        if (server->clients[i].fd >= 0) {
+            daemonDrop(server, i);
+            close(server->clients[i].fd);
+            server->clients[i].fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&rb->lock);
+    free(fds);
+    free(slots);
+    return NULL;
+}
+
+/*
+ * This function sends as much of a client's queue as its socket takes without blocking
+ * Assumption: Only called by the sender thread, which is the only one that frees the queue. The fd is not
+ *             closed while the queue is not empty, so it can be used outside the lock
+ * Input parameters: reorderBuffer *rb, int slot
+ * Returns: int (1) if the client is fine, (0) if the socket failed
+*/
+int daemonSend(reorderBuffer *rb, int slot) {
+    daemonServer *server = rb->server;
+    while (1) {
+        pthread_mutex_lock(&rb->lock);
+        daemonClient *client = &server->clients[slot]; // Looked up each time, accepting may move the array
+        outgoingReply *out = client->outHead;
+        int fd = client->fd;
+        size_t sent = client->outSent;
+        pthread_mutex_unlock(&rb->lock);
+        if (!out)
+            return 1;
+
+        ssize_t n = send(fd, (char *) &out->reply + sent, out->len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return 1;
+        if (n <= 0)
+            return 0;
+
+        pthread_mutex_lock(&rb->lock);
+        client = &server->clients[slot];
+        client->outSent += n;
+        if (client->outSent == out->len) {
+            client->outHead = out->next;
+            if (!client->outHead)
+                client->outTail = NULL;
+            client->outBytes -= out->len;
+            client->outSent = 0;
+            free(out);
+            daemonRelease(server, slot);
+        }
+        pthread_mutex_unlock(&rb->lock);
+    }
+}
+
+/*
+ * This function throws away a dead client's queue and shuts its socket, so the client sees EOF and the daemon
+ * thread stops reading it. The slot is closed by daemonRelease once no replies are pending
+ * Assumption: The reorder buffer lock is held, only called by the sender thread
+ * Input parameters: daemonServer *server, int slot
+ * Returns: void
+*/
+void daemonDrop(daemonServer *server, int slot) {
+    daemonClient *client = &server->clients[slot];
+    while (client->outHead) {
+        outgoingReply *out = client->outHead;
+        client->outHead = out->next;
+        free(out);
+    }
+    client->outTail = NULL;
+    client->outBytes = client->outSent = 0;
+    shutdown(client->fd, SHUT_RDWR);
+    daemonRelease(server, slot);
+}
+
+/*
+ * This function starts the A file loader
+ * Assumption: depth > 0, slots are used by the caller in order 0..depth-1 and back around
+ * Input parameters: aLoader *loader, int depth, int tryUring
+ * Returns: void, loader->useUring says which backend is running
+*/
+void loaderStart(aLoader *loader, int depth, int tryUring) {
+    memset(loader, 0, sizeof(aLoader));
+    loader->depth = depth;
+    loader->slots = calloc(depth, sizeof(loadSlot));
+    for (int i = 0; i < depth; i++) {
+        loader->slots[i].cap = LOAD_BUF_SIZE;
+        loader->slots[i].buf = malloc(LOAD_BUF_SIZE);
+    }
+    loader->useUring = tryUring && uringSetup(loader);
+    if (loader->useUring)
+        return;
+
+    // Plain threads fallback, one per slot so depth reads can block on the disk at once
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->work, NULL);
+    pthread_cond_init(&loader->done, NULL);
+    loader->queue = malloc(sizeof(int) * depth);
+    loader->threads = malloc(sizeof(pthread_t) * depth);
+    for (int i = 0; i < depth; i++)
+        pthread_create(&loader->threads[i], NULL, loaderThreadRun, loader);
+}
+
+/*
+ * This function starts reading an A file into a slot
+ * Assumption: slot is LOAD_FREE
+ * Input parameters: aLoader *loader, int slot, const char *name
+ * Returns: void, the read finishes in the background (a name too long to keep is done at once, as an error)
+*/
+void loaderSubmit(aLoader *loader, int slot, const char *name) {
+    loadSlot *s = &loader->slots[slot];
+    snprintf(s->name, NAME_SIZE, "%s", name);
+    s->len = -1;
+    s->fd = -1;
+    s->error = 0;
+
+    // A cut name would open some other file, or fail naming a file that was never asked for
+    if (strlen(name) >= NAME_SIZE) {
+        s->error = ENAMETOOLONG;
+        s->state = LOAD_DONE;
+        return;
+    }
+
+    if (loader->useUring) {
+        s->state = LOAD_OPENING;
+        uringPush(loader, IORING_OP_OPENAT, slot);
+        return;
+    }
+
+    pthread_mutex_lock(&loader->lock);
+    s->state = LOAD_QUEUED;
+    loader->queue[(loader->queueHead + loader->queueCount) % loader->depth] = slot;
+    loader->queueCount++;
+    pthread_cond_signal(&loader->work);
+    pthread_mutex_unlock(&loader->lock);
+}
+
+/*
+ * This function waits until a slot's file has been read
+ * Assumption: loaderSubmit was called for slot
+ * Input parameters: aLoader *loader, int slot
+ * Returns: loadSlot* with the file contents, the caller sets it back to LOAD_FREE when done
+*/
+loadSlot *loaderWait(aLoader *loader, int slot) {
+    loadSlot *s = &loader->slots[slot];
+
+    if (loader->useUring) {
+        while (s->state != LOAD_DONE)
+            uringReap(loader);
+        return s;
+    }
+
+    pthread_mutex_lock(&loader->lock);
+    while (s->state != LOAD_DONE)
+        pthread_cond_wait(&loader->done, &loader->lock);
+    pthread_mutex_unlock(&loader->lock);
+    return s;
+}
+
+/*
+ * This function stops the loader and frees it
+ * Assumption: Nothing is in flight
+ * Input parameters: aLoader *loader
+ * Returns: void
+*/
+void loaderStop(aLoader *loader) {
+    if (loader->useUring) {
+        munmap(loader->sqeRing, loader->sqeRingSize);
+        if (loader->cqRing != loader->sqRing)
+            munmap(loader->cqRing, loader->cqRingSize);
+        munmap(loader->sqRing, loader->sqRingSize);
+        close(loader->ringFd);
+    } else {
+        pthread_mutex_lock(&loader->lock);
+        loader->stopping = 1;
+        pthread_cond_broadcast(&loader->work);
+        pthread_mutex_unlock(&loader->lock);
+        for (int i = 0; i < loader->depth; i++)
+            pthread_join(loader->threads[i], NULL);
+        pthread_mutex_destroy(&loader->lock);
+        pthread_cond_destroy(&loader->work);
+        pthread_cond_destroy(&loader->done);
+        free(loader->threads);
+        free(loader->queue);
+    }
+    for (int i = 0; i < loader->depth; i++)
+        free(loader->slots[i].buf);
+    free(loader->slots);
+}
+
+/*
+ * This function sets up an io_uring with room for every slot to have one operation in flight
+ * Assumption: Called once from loaderStart
+ * Input parameters: aLoader *loader
+ * Returns: int (1) if io_uring is usable, (0) to fall back to threads
+*/
+int uringSetup(aLoader *loader) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int) syscall(__NR_io_uring_setup, loader->depth, &params);
+    if (fd < 0)
+        return 0;
+
+    // OPENAT and READ came in 5.6, check for them rather than the kernel version
+    size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probeSize);
+    int supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                    probe->last_op >= IORING_OP_READ &&
+                    (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+                    (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported) {
+        close(fd);
+        return 0;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqSize = cqSize = sqSize > cqSize ? sqSize : cqSize;
+
+    char *sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    char *cq = sq;
+    if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+        cq = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    size_t sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (cq != MAP_FAILED && cq != sq)
+            munmap(cq, cqSize);
+        if (sq != MAP_FAILED)
+            munmap(sq, sqSize);
+        close(fd);
+        return 0;
+    }
+
+    loader->ringFd = fd;
+    loader->sqRing = sq;
+    loader->sqRingSize = sqSize;
+    loader->cqRing = cq;
+    loader->cqRingSize = cqSize;
+    loader->sqeRing = sqes;
+    loader->sqeRingSize = sqesSize;
+    loader->sqTail = (unsigned *) (sq + params.sq_off.tail);
+    loader->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    loader->sqArray = (unsigned *) (sq + params.sq_off.array);
+    loader->cqHead = (unsigned *) (cq + params.cq_off.head);
+    loader->cqTail = (unsigned *) (cq + params.cq_off.tail);
+    loader->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    loader->sqes = sqes;
+    loader->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return 1;
+}
+
+/*
+ * This function queues the next operation for a slot and submits it
+ * Assumption: The slot has nothing else in flight, so the ring can never be full. A READ goes on from len,
+ *             into the rest of buf
+ * Input parameters: aLoader *loader, int opcode (IORING_OP_OPENAT or IORING_OP_READ), int slot
+ * Returns: void, an SQE the kernel did not take yet is submitted again by uringReap
+*/
+void uringPush(aLoader *loader, int opcode, int slot) {
+    loadSlot *s = &loader->slots[slot];
+    unsigned tail = *loader->sqTail;
+    unsigned index = tail & *loader->sqMask;
+    struct io_uring_sqe *sqe = &loader->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = slot;
+    if (opcode == IORING_OP_OPENAT) {
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long) s->name;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    } else {
+        sqe->fd = s->fd;
+        sqe->addr = (unsigned long) (s->buf + s->len);
+        sqe->len = (unsigned) (s->cap - s->len);
+        sqe->off = (unsigned long) s->len;
+    }
+
+    loader->sqArray[index] = index;
+    __atomic_store_n(loader->sqTail, tail + 1, __ATOMIC_RELEASE);
+    loader->unsubmitted++;
+    uringSubmit(loader, 0);
+}
+
+/*
+ * This function hands the kernel the SQEs it has not taken yet, and waits for a completion if asked to
+ * Assumption: Only called by the thread that submits
+ * Input parameters: aLoader *loader, int wait
+ * Returns: void, SQEs left over after EAGAIN or EBUSY stay counted for the next call, exits on other errors
+*/
+void uringSubmit(aLoader *loader, int wait) {
+    while (1) {
+        int taken = (int) syscall(__NR_io_uring_enter, loader->ringFd, loader->unsubmitted, wait ? 1 : 0,
+                                  wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (taken >= 0) {
+            loader->unsubmitted -= (unsigned) taken;
+            if (loader->unsubmitted == 0 || wait)
+                return;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EBUSY)
+            return; // Out of kernel memory or completions to reap first, the caller comes back
+        perror("io_uring_enter");
+        exit(1);
+    }
+}
+
+/*
+ * This function handles finished operations, moving each slot from open to read to done
+ * Assumption: Only called by the thread that submits
+ * Input parameters: aLoader *loader
+ * Returns: void, blocks until at least one operation has finished
+*/
+void uringReap(aLoader *loader) {
+    unsigned head = *loader->cqHead;
+    if (head == __atomic_load_n(loader->cqTail, __ATOMIC_ACQUIRE)) {
+        uringSubmit(loader, 1);
+        return;
+    }
+
+    while (head != __atomic_load_n(loader->cqTail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &loader->cqes[head & *loader->cqMask];
+        loadSlot *s = &loader->slots[cqe->user_data];
+        int res = cqe->res;
+        head++;
+        __atomic_store_n(loader->cqHead, head, __ATOMIC_RELEASE);
+
+        if (s->state == LOAD_OPENING && res >= 0) {
+            s->fd = res;
+            s->len = 0;
+            s->state = LOAD_READING;
+            uringPush(loader, IORING_OP_READ, (int) (s - loader->slots));
+            continue;
+        }
+        // Read on from where the last READ stopped until EOF, growing buf when it is full
+        if (s->state == LOAD_READING && res > 0) {
+            s->len += res;
+            if (loadGrow(s) == 0) {
+                uringPush(loader, IORING_OP_READ, (int) (s - loader->slots));
+                continue;
+            }
+        }
+        if (res < 0)
+            s->error = -res;
+        if (s->error)
+            s->len = -1;
+        if (s->state == LOAD_READING)
+            close(s->fd);
+        s->state = LOAD_DONE; // A failed open also ends here with len -1
+    }
+}
+
+/*
+ * This function makes room in a slot's buffer for more of its file once the buffer is full
+ * Assumption: s->len bytes have been read so far
+ * Input parameters: loadSlot *s
+ * Returns: int (0) if there is room to read into, (-1) with s->error set if the file cannot be held
+*/
+int loadGrow(loadSlot *s) {
+    if ((size_t) s->len < s->cap)
+        return 0;
+    if (s->cap >= LOAD_MAX) {
+        s->error = EFBIG;
+        return -1;
+    }
+    size_t cap = s->cap * 2 < LOAD_MAX ? s->cap * 2 : LOAD_MAX;
+    char *buf = realloc(s->buf, cap);
+    if (!buf) {
+        s->error = ENOMEM;
+        return -1;
+    }
+    s->buf = buf;
+    s->cap = cap;
+    return 0;
+}
+
+/*
+ * This function is a loader thread for when io_uring is not available
+ * Assumption: To be ran as a thread
+ * Input parameters: void* givenLoader (an aLoader)
+ * Returns: NULL when the loader is stopped
+*/
+void* loaderThreadRun(void* givenLoader) {
+    aLoader *loader = (aLoader*) givenLoader;
+
+    pthread_mutex_lock(&loader->lock);
+    while (1) {
+        while (loader->queueCount == 0 && !loader->stopping)
+            pthread_cond_wait(&loader->work, &loader->lock);
+        if (loader->queueCount == 0) break;
+
+        loadSlot *s = &loader->slots[loader->queue[loader->queueHead]];
+        loader->queueHead = (loader->queueHead + 1) % loader->depth;
+        loader->queueCount--;
+        pthread_mutex_unlock(&loader->lock);
+
+        // Blocking open and read until EOF, other threads keep their own files in flight. The slot is only
+        // ours until it is done
+        s->len = 0;
+        int fd = open(s->name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            s->error = errno;
+        while (fd >= 0 && loadGrow(s) == 0) {
+            ssize_t n = read(fd, s->buf + s->len, s->cap - s->len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                s->error = errno;
+            if (n <= 0)
+                break;
+            s->len += n;
+        }
+        if (fd >= 0)
+            close(fd);
+
+        pthread_mutex_lock(&loader->lock);
+        if (s->error)
+            s->len = -1;
+        s->state = LOAD_DONE;
+        pthread_cond_broadcast(&loader->done);
+    }
+    pthread_mutex_unlock(&loader->lock);
+    return NULL;
+}
+
+/*
+ * This function returns the next complete line from the reader, without the newline
+ * Assumption: The returned line is only valid until the next call to fillLines
+ * Input parameters: lineReader *reader
+ * Returns: char* to the line, or NULL if no complete line is buffered (at EOF a last unterminated line counts)
+*/
+char *nextLine(lineReader *reader) {
+    char *start = reader->buf + reader->start;
+    char *newline = memchr(start, '\n', reader->end - reader->start);
+
+    if (!newline) {
+        if (!reader->eof || reader->start == reader->end)
+            return NULL;
+        reader->buf[reader->end] = '\0'; // Last line has no newline, there is always room for the \0
+        reader->start = reader->end;
+        return start;
+    }
+    *newline = '\0';
+    reader->start = newline - reader->buf + 1;
+    return start;
+}
+
+/*
+ * This function reads once from stdin into the reader, moving any partial line to the front first
+ * Assumption: Blocks if stdin has nothing, so call stdinReady first when that matters
+ * Input parameters: lineReader *reader
+ * Returns: void, sets eof when stdin is done
+*/
+void fillLines(lineReader *reader) {
+    memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+
+    // A line that fills the whole buffer is cut here and the rest becomes the next line
+    if (reader->end == LINE_BUF_SIZE - 1) {
+        reader->buf[reader->end] = '\n';
+        reader->end++;
+        return;
+    }
+
+    ssize_t n = read(STDIN_FILENO, reader->buf + reader->end, LINE_BUF_SIZE - 1 - reader->end);
+    if (n <= 0)
+        reader->eof = 1;
+    else
+        reader->end += n;
+}
+
+/*
+ * This function checks if stdin can be read without blocking
+ * Assumption: none
+ * Input parameters: none
+ * Returns: int (1) if a read would not block
+*/
+int stdinReady(void) {
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/*
+ * This function checks the file and prints errors if needed
+ * Assumption: file is not null, there is a filename
+ * Input parameters: FILE *file, const char *filename
+ * Returns: void, exits if needed
+*/
+void checkFile(FILE *file, const char *filename) {
+    if (file == NULL) { // If there is no file, or you can't access it
+        fprintf(stderr, "error: cannot open file %s\n", filename);
+        exit(1); // End the program here, do not return
+    }
+}
+
+/*
+ * This function reads the file and populates the given matrix.
+ * Assumption: file has been checked, matrix is already initialized, and rows and columns are known
+ * Input parameters: FILE *file, int rows, int cols, int matrix[][cols]
+ * Returns: matrixShape, the rows and the widest row the file has (at most rows x cols), updates matrix by reference
+*/
+matrixShape readFile(FILE *file, int rows, int cols, int matrix[][cols]) {
+    // Initialize row and column counters
+    size_t i = 0;
+    size_t j = 0;
+    matrixShape shape = {0, 0};
+
+    // Read the file line by line
+    char *buf = malloc(LINE_SIZE);
+    while (fgets(buf, LINE_SIZE, file) != NULL) {
+
+        // A Matrix Market file says so on its first line, the rest of it is read differently
+        if (i == 0 && strncmp(buf, "%%MatrixMarket", 14) == 0) {
+            shape = readMatrixMarket(file, buf, rows, cols, matrix);
+            break;
+        }
+
+        // Remove trailing newline character
+        if (buf[strlen(buf) - 1] == '\n') buf[strlen(buf) - 1] = '\0';
+
+        // Tokenize the line and populate the matrix
+        char *token = strtok(buf, " ");
+        while (token != NULL) { // Until tjhe end
+            if (i < rows && j < cols) { // Ignore other values
+                matrix[i][j] = atoi(token); // Convert string to int
+                j++; // Next column
+            }
+            token = strtok(NULL, " "); // Last one
+        }
+
+        // Remember the extent of what was read, a blank line does not count as a row
+        if (j > 0 && i < rows)
+            shape.rows = (int) i + 1;
+        if (j > shape.cols)
+            shape.cols = (int) j;
+        i++; // Next row
+        j = 0; // Reset column count for the new row
+    }
+    free(buf);
+    return shape;
+}
+
+/*
+ * This function reads the rest of a Matrix Market (.mtx) file after readFile has read its header line
+ * Assumption: coordinate or array format, integer, real (cut to int) or pattern values, general, symmetric or
+ *             skew-symmetric. Indexes in the file start at 1, cells past rows x cols are ignored. Array
+ *             symmetric and skew-symmetric files hold only the lower triangle, a column at a time
+ * Input parameters: FILE *file, const char *header, int rows, int cols, int matrix[][cols]
+ * Returns: matrixShape, the size line of the file cut to rows x cols, updates matrix by reference
+*/
+matrixShape readMatrixMarket(FILE *file, const char *header, int rows, int cols, int matrix[][cols]) {
+    char format[16] = "", field[16] = "", symmetry[16] = "";
+    matrixShape shape = {0, 0};
+    long m = 0, n = 0, entries = 0;
+    sscanf(header, "%%%%MatrixMarket %*s %15s %15s %15s", format, field, symmetry);
+    int coordinate = strcmp(format, "coordinate") == 0;
+    int pattern = strcmp(field, "pattern") == 0;
+    int mirror = strcmp(symmetry, "general") == 0 ? 0 : strcmp(symmetry, "skew-symmetric") == 0 ? -1 : 1;
+
+    char *buf = malloc(LINE_SIZE);
+    // Next cell in array format, a column at a time. Symmetric files list only the lower triangle of each
+    // column and skew-symmetric ones leave out the diagonal too, so column j starts at row j or j + 1
+    long row = mirror < 0, col = 0;
+    while (fgets(buf, LINE_SIZE, file) != NULL) {
+        if (buf[0] == '%' || buf[strspn(buf, " \t\r\n")] == '\0')
+            continue; // Comments and blank lines
+        if (m == 0) {
+            if (sscanf(buf, "%ld %ld %ld", &m, &n, &entries) < 2)
+                break;
+            shape.rows = m < rows ? (int) m : rows;
+            shape.cols = n < cols ? (int) n : cols;
+            continue;
+        }
+
+        long i, j;
+        double value = 1;
+        if (coordinate) {
+            if (sscanf(buf, "%ld %ld %lf", &i, &j, &value) < (pattern ? 2 : 3))
+                continue;
+            i--;
+            j--;
+        } else {
+            if (sscanf(buf, "%lf", &value) != 1)
+                continue;
+            i = row;
+            j = col;
+            if (++row == m) {
+                col++;
+                row = mirror == 0 ? 0 : col + (mirror < 0);
+            }
+        }
+        if (i >= 0 && j >= 0 && i < rows && j < cols)
+            matrix[i][j] = (int) value;
+        if (mirror && i != j && j < rows && i < cols && i >= 0 && j >= 0)
+            matrix[j][i] = (int) value * mirror;
+    }
+    free(buf);
+    return shape;
+}
+
+/*
+ * This function finds the shape of a matrix that did not come from a file, the rows and columns before the
+ * trailing ones that are all 0
+ * Assumption: none
+ * Input parameters: int A[][SIZE]
+ * Returns: matrixShape
+*/
+matrixShape shapeOf(int A[][SIZE]) {
+    matrixShape shape = {0, 0};
+    for (int i = 0; i < SIZE; i++) {
+        for (int j = 0; j < SIZE; j++) {
+            if (A[i][j] != 0) {
+                shape.rows = i + 1;
+                if (j + 1 > shape.cols)
+                    shape.cols = j + 1;
+            }
+        }
     }
+    return shape;
 }
 
 /*
@@ -0,0 +1,171 @@
+/*
+ * Description: Reads products back out of a result store written by matrixmult_multiwa -o
+ * Author names: Trevor Mathisen
+ * Author emails: trevor.mathisen@sjsu.edu
+ * Last modified date: 10/18/2026
+ * Creation date: 10/18/2026
+ */
+
+/* Example:
+    $ ./matrixmult_multiwa -o results.rst test/A1.txt test/W1.txt test/W2.txt test/W3.txt < cmds.txt
+
+    List the W files and how many products each one has:
+    $ ./matrixmult_store results.rst
+
+    Fetch the product of A number 2 (0 is the A on the command line) with W2, without parsing any .out file:
+    $ ./matrixmult_store results.rst 2 test/W2.txt
+    test/A3.txt x test/W2.txt=[
+    ...
+    ]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef SIZE
+#define SIZE 8 // Same -DSIZE=N as matrixmult_multiwa
+#endif
+#define NAME_SIZE 100 // A filenames of 100 chars max, same as matrixmult_multiwa
+
+/*
+ * This structure is the header at the start of a result store file
+ * Assumption: Matches storeHeader in matrixmult_multiwa.c and matrixmult_threaded.c
+ * Input parameters: the matrix size, the number of W files and the record layout
+ * Returns: Nothing
+*/
+struct storeHeader {
+    char magic[8];
+    int size;
+    int numW;
+    int recordSize;
+    int dataOffset;
+} typedef storeHeader;
+
+/*
+ * This structure is one fixed stride record of the result store
+ * Assumption: Matches storeRecord in matrixmult_threaded.c
+ * Input parameters: the request number, the A filename and the product
+ * Returns: Nothing
+*/
+struct storeRecord {
+    int valid;
+    int seq;
+    char name[NAME_SIZE];
+    int R[SIZE][SIZE];
+} typedef storeRecord;
+
+// Function prototypes
+const storeRecord *findRecord(const char *map, size_t mapLen, long seq, int w);
+void printRecord(const storeRecord *record, const char *wName);
+
+int main(int argc, char* argv[]) {
+    struct stat st;
+
+    if (argc != 2 && argc != 4) { // argv[0] is program name
+        fprintf(stderr, "usage: %s store [seq W.txt]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(storeHeader)) {
+        fprintf(stderr, "error: cannot open file %s\n", argv[1]);
+        return 1;
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    const storeHeader *header = (const storeHeader *) map;
+    if (memcmp(header->magic, "MMSTORE1", 8) != 0 || header->size != SIZE ||
+        header->recordSize != sizeof(storeRecord)) {
+        fprintf(stderr, "error: %s is not a result store for %dx%d matrices\n", argv[1], SIZE, SIZE);
+        return 1;
+    }
+    const char (*wNames)[NAME_SIZE] = (const char (*)[NAME_SIZE]) (map + sizeof(storeHeader));
+
+    // No key given, list what is in the store
+    if (argc == 2) {
+        long seqs = (st.st_size - header->dataOffset) / ((long) header->recordSize * header->numW);
+        for (int w = 0; w < header->numW; w++) {
+            long count = 0;
+            for (long seq = 0; seq < seqs; seq++)
+                if (findRecord(map, st.st_size, seq, w))
+                    count++;
+            fprintf(stdout, "%d: %s, %ld products\n", w, wNames[w], count);
+        }
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    // Look up the W index by name, then the record is at a fixed offset
+    int w;
+    for (w = 0; w < header->numW; w++) {
+        if (strncmp(wNames[w], argv[3], NAME_SIZE) == 0)
+            break;
+    }
+    if (w == header->numW) {
+        fprintf(stderr, "error: %s is not in %s\n", argv[3], argv[1]);
+        return 1;
+    }
+
+    const storeRecord *record = findRecord(map, st.st_size, atol(argv[2]), w);
+    if (!record) {
+        fprintf(stderr, "error: no product for A number %s x %s\n", argv[2], argv[3]);
+        return 1;
+    }
+    printRecord(record, wNames[w]);
+
+    munmap(map, st.st_size);
+    return 0;
+}
+
+/*
+ * This function finds the record for A number seq times W number w
+ * Assumption: map holds a whole store with a checked header
+ * Input parameters: const char *map, size_t mapLen, long seq, int w
+ * Returns: the record, or NULL if it is past the end of the file or was never written
+*/
+const storeRecord *findRecord(const char *map, size_t mapLen, long seq, int w) {
+    const storeHeader *header = (const storeHeader *) map;
+    if (seq < 0)
+        return NULL;
+
+    size_t offset = header->dataOffset + ((size_t) seq * header->numW + w) * header->recordSize;
+    if (offset + header->recordSize > mapLen)
+        return NULL;
+
+    const storeRecord *record = (const storeRecord *) (map + offset);
+    if (!__atomic_load_n(&record->valid, __ATOMIC_ACQUIRE))
+        return NULL;
+    return record;
+}
+
+/*
+ * This function prints a record in the same layout as printArrayContents
+ * Assumption: record is valid
+ * Input parameters: const storeRecord *record, const char *wName
+ * Returns: void
+*/
+void printRecord(const storeRecord *record, const char *wName) {
+    size_t i, j;
+
+    fprintf(stdout, "%s x %s=[\n", record->name, wName);
+    for (i = 0; i < SIZE; i++) { // For each row
+        for (j = 0; j < SIZE; j++) { // For each column
+            if (record->R[i][j] < 10 && record->R[i][j] > 0)
+                fprintf(stdout, " "); // Print a space for single digits (for formatting
+            fprintf(stdout, "%d ", record->R[i][j]); // Print the value
+        }
+        fprintf(stdout, "\n"); // New line for each row
+    }
+    fprintf(stdout, "\n]\n");
+}
@@ -1,42 +1,448 @@
+#define _GNU_SOURCE // sched_getaffinity, pthread_attr_setaffinity_np
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <stdint.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#ifdef __SSE2__
+#include <emmintrin.h> // _mm_madd_epi16, 8 int16 multiplies added in pairs into 4 int32
+#endif
 
-#define SIZE 8
+#ifndef SIZE
+#define SIZE 8 // Build with -DSIZE=N for bigger matrices, matrixmult_multiwa has to use the same N
+#endif
+#define LINE_SIZE (SIZE * 12 + 2) // Longest line readFile takes, SIZE ints and their spaces
 #define READ_END 0
 #define WRITE_END 1
 #define MATRIX_SIZE sizeof(int) * SIZE * SIZE
+#define NAME_SIZE 100 // A filenames of 100 chars max, same as the parent
+#define RING_SLOTS 16 // Products buffered by the streaming writer before compute blocks
+#define STEAL_MIN_SIZE 128 // Threaded products at least this big are split into tiles and balanced by stealing
+#define TILE 32 // Output tile edge for work stealing
+#define BATCH_MAX 16 // Largest batch if BATCH only gives a wait
+#define BATCH_WAIT_US 1000 // Longest a batch waits for more As if BATCH only gives a size
+#define BIT_WORDS ((SIZE + 63) / 64) // 64 bit words per packed column of a 0/1 W
+#define SPARSE_DENSITY 0.3 // W with at most this fraction of its cells not 0 is kept in CSR, unless SPARSE says
+
+// Mutex for critical sections
+pthread_mutex_t mutex;
+int jobRead = -1; // JOBSERVER token pipe from the parent, -1 if there is none
+int jobWrite = -1;
+cpu_set_t workerCpus; // The cpus the parent pinned us to with AFFINITY, each worker is pinned to one of them
+int pinWorkers = 0;
+
+enum { POLICY_SERIAL, POLICY_THREADED, POLICY_PROCESS, POLICY_AUTO }; // How a product is computed
+const char *policyNames[] = {"serial", "threaded", "process", "auto"};
+
+/*
+ * This structure is the part of a matrix its file really has, the rest of the SIZE x SIZE buffer is 0
+ * Assumption: rows and cols are at most SIZE
+ * Input parameters: the number of rows and the widest row read
+ * Returns: Nothing
+*/
+struct matrixShape {
+    int rows;
+    int cols;
+} typedef matrixShape;
+
+/*
+ * This structure is W in compressed sparse rows, only the cells that are not 0
+ * Assumption: The cells of row k are col[rowStart[k]..rowStart[k + 1] - 1], in column order
+ * Input parameters: the rows kept, the number of cells, where each row starts and each cell's column and value
+ * Returns: Nothing
+*/
+struct csrMatrix {
+    int rows;
+    int nnz;
+    int rowStart[SIZE + 1];
+    int *col;
+    int *val;
+} typedef csrMatrix;
+
+/*
+ * This structure is a W that is only 0 and 1, packed a column at a time
+ * Assumption: Bit k % 64 of cols[c][k / 64] is W[k][c]
+ * Input parameters: the number of cells that are 1 and the packed columns
+ * Returns: Nothing
+*/
+struct bitMatrix {
+    int ones;
+    uint64_t cols[SIZE][BIT_WORDS];
+} typedef bitMatrix;
 
 /*
- * This structure is used to pass thread data
- * Assumption: Will be used by a thread and stored in a 2D array
+ * This structure is used to pass thread data, one per product shared by all its workers
+ * Assumption: Workers take grain rows at a time from nextRow until every row is done
  * Input parameters: as below
  * Returns: Nothing
 */
-// Mutex for critical sections
-pthread_mutex_t mutex;
 struct threadData {
-    int row;
-    int col;
     int (*A)[SIZE];
     int (*W)[SIZE];
+    const csrMatrix *sparseW; // W in CSR when that is faster, NULL to multiply W dense
+    const bitMatrix *bitW; // W packed when it is only 0 and 1, then W and sparseW are not used
+    int16_t (*A16)[SIZE]; // A in int16 when it and W fit and no sum can overflow, NULL to multiply in int32
+    int16_t (*W16)[SIZE]; // W transposed in int16, W16[c] is column c of W
     int (**R);
-    int iterationNum;
+    int rows; // Rows of A and of the product, SIZE for each A stacked in the batch
+    int cols; // Columns of W, the product's columns past them are 0
+    int inner; // Columns of A and rows of W that are multiplied, the rest are 0
+    int offset; // Row of R the product starts at
+    int grain; // Rows per chunk
+    int nextRow; // First row of the next chunk, taken with an atomic add
 } typedef threadData;
 
+/*
+ * This structure is one worker's deque of output tiles. The owner takes from the bottom, thieves from the top
+ * Assumption: Tiles are only ever removed, so a deque that is empty stays empty
+ * Input parameters: the tile numbers and the lock
+ * Returns: Nothing
+*/
+struct tileDeque {
+    int *tiles;
+    int top;
+    int bottom;
+    pthread_mutex_t lock;
+} typedef tileDeque;
+
+/*
+ * This structure is what each work stealing worker gets
+ * Assumption: deques has workers entries, self is this worker's
+ * Input parameters: as below
+ * Returns: Nothing
+*/
+struct stealWorker {
+    threadData *data;
+    tileDeque *deques;
+    int workers;
+    int self;
+    unsigned int seed; // For rand_r, picking a random victim
+} typedef stealWorker;
+
+/*
+ * This structure is the calibrated cost model the execution plan is picked from
+ * Assumption: Measured at startup or loaded from the PROFILE file
+ * Input parameters: as below
+ * Returns: Nothing
+*/
+struct costModel {
+    double threadUs; // pthread_create + pthread_join of one worker
+    double forkUs; // fork + waitpid of one worker
+    double maddNs; // One multiply-add of the kernel
+    int cores;
+} typedef costModel;
+
+/*
+ * This structure is how one product is computed
+ * Assumption: workers is 1 for POLICY_SERIAL
+ * Input parameters: the policy, the number of workers and the rows per chunk
+ * Returns: Nothing
+*/
+struct execPlan {
+    int policy;
+    int workers;
+    int grain;
+} typedef execPlan;
+
+/*
+ * This structure is one request read from the parent's pipe
+ * Assumption: Matches requestInfo in matrixmult_multiwa.c
+ * Input parameters: the request number, the A filename, its shape and the A matrix
+ * Returns: Nothing
+*/
+struct requestInfo {
+    int seq;
+    char name[NAME_SIZE];
+    matrixShape shape; // What the A file really has
+    int A[SIZE][SIZE];
+} typedef requestInfo;
+
+/*
+ * This structure is the adaptive batching state (BATCH is set). As that are already waiting are always taken,
+ * up to maxBatch. The batch only waits for more while they are expected to come within maxWaitUs
+ * Assumption: gapUs is an average of the time between As, so the wait follows the arrival rate
+ * Input parameters: the largest batch and longest wait parsed from BATCH, and the running averages
+ * Returns: Nothing
+*/
+struct batchPolicy {
+    int maxBatch;
+    long maxWaitUs;
+    double gapUs; // Moving average of the time between two As
+    double lastArrival; // When the last A was read, in us
+    long batches;
+    long requests;
+    int largest;
+    double waitedUs; // Time spent waiting for As that were not there yet
+} typedef batchPolicy;
+
+/*
+ * This structure is one product in the result cache, on its hash bucket's chain and on the LRU list
+ * Assumption: A is kept so a hash collision is never taken for a hit
+ * Input parameters: the hash of A, A and its product with our W
+ * Returns: Nothing
+*/
+struct cacheEntry {
+    uint64_t hash;
+    int A[SIZE][SIZE];
+    int R[SIZE][SIZE];
+    struct cacheEntry *chain; // Next entry in the same bucket
+    struct cacheEntry *newer; // LRU list, most recently used at the head
+    struct cacheEntry *older;
+} typedef cacheEntry;
+
+/*
+ * This structure is the result cache (CACHE_MB is set). As repeat, so their products with our W are kept
+ * keyed by a hash of A's bytes, the least recently used one is evicted when the cache is full
+ * Assumption: Only used by the compute (main) thread
+ * Input parameters: the number of entries that fit in CACHE_MB, the buckets and the counters
+ * Returns: Nothing
+*/
+struct resultCache {
+    cacheEntry **buckets;
+    size_t numBuckets; // A power of 2
+    size_t capacity;
+    size_t count;
+    cacheEntry *newest;
+    cacheEntry *oldest;
+    long hits;
+    long misses;
+    long evictions;
+} typedef resultCache;
+
+/*
+ * This structure is one slot of the streaming writer's ring buffer
+ * Assumption: R is a copy, so compute can reuse its buffer as soon as the slot is queued
+ * Input parameters: the A matrix number and its product
+ * Returns: Nothing
+*/
+struct resultSlot {
+    int iterationNum;
+    char name[NAME_SIZE];
+    int R[SIZE][SIZE];
+} typedef resultSlot;
+
+/*
+ * This structure is used by the streaming writer thread (STREAM is set)
+ * Assumption: One producer (main) and one consumer (the writer thread)
+ * Input parameters: flush policy parsed from STREAM, the W filename for the header lines
+ * Returns: Nothing
+*/
+struct streamWriter {
+    resultSlot ring[RING_SLOTS];
+    size_t head;
+    size_t count;
+    int flushEvery; // fflush after this many products, 0 to only flush on time
+    long flushMs; // fflush at least this often while products are pending, 0 to only flush on count
+    int done;
+    const char *wName;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    pthread_t thread;
+} typedef streamWriter;
+
+/*
+ * This structure is one product sent back to the parent on the RESULT pipe
+ * Assumption: Matches resultInfo in matrixmult_multiwa.c, one writer per pipe so it may take several writes
+ * Input parameters: the request number and the product
+ * Returns: Nothing
+*/
+struct resultInfo {
+    int seq;
+    int R[SIZE][SIZE];
+} typedef resultInfo;
+
+/*
+ * This structure is the header at the start of a result store file (STORE is set)
+ * Assumption: Matches storeHeader in matrixmult_multiwa.c and matrixmult_store.c. The numW W filenames,
+ *             NAME_SIZE chars each, follow it. Records start at dataOffset.
+ * Input parameters: written once by the parent
+ * Returns: Nothing
+*/
+struct storeHeader {
+    char magic[8];
+    int size;
+    int numW;
+    int recordSize;
+    int dataOffset;
+} typedef storeHeader;
+
+/*
+ * This structure is one fixed stride record of the result store, A number seq times W number w is at
+ * dataOffset + (seq * numW + w) * recordSize
+ * Assumption: valid is set last, so a reader never sees a half written R
+ * Input parameters: the request number, the A filename and the product
+ * Returns: Nothing
+*/
+struct storeRecord {
+    int valid;
+    int seq;
+    char name[NAME_SIZE];
+    int R[SIZE][SIZE];
+} typedef storeRecord;
+
+/*
+ * This structure is a child's view of the memory mapped result store
+ * Assumption: Every child maps the same file and only writes its own W's records
+ * Input parameters: the store file descriptor, this child's W number and the current mapping
+ * Returns: Nothing
+*/
+struct resultStore {
+    int fd;
+    int index;
+    int numW;
+    size_t recordSize;
+    size_t dataOffset;
+    size_t mapLen;
+    char *map;
+} typedef resultStore;
+
+/*
+ * This structure asks the zygote for a worker. The child's stdin pipe, and its result pipe with -r, come
+ * with it as SCM_RIGHTS, the zygote answers with the worker's pid
+ * Assumption: Matches zygoteRequest in matrixmult_multiwa.c
+ * Input parameters: the 1 based command number (its W is argv[command + 1]) and the cpus to pin it to
+ * Returns: Nothing
+*/
+struct zygoteRequest {
+    int command;
+    int pinned;
+    cpu_set_t cpus;
+    char cpuList[256]; // cpus as the parent prints them, for the Pinned line
+} typedef zygoteRequest;
+
+/*
+ * This structure is written to the zygote's exit pipe each time a worker exits, the parent cannot waitpid
+ * for processes it did not fork
+ * Assumption: Matches zygoteExit in matrixmult_multiwa.c, smaller than PIPE_BUF so each write is atomic
+ * Input parameters: the worker's pid and its status from waitpid
+ * Returns: Nothing
+*/
+struct zygoteExit {
+    pid_t pid;
+    int status;
+} typedef zygoteExit;
+
 // Function prototypes
 void checkFile(FILE *file, const char *filename);
-void readFile(FILE *file, int rows, int cols, int matrix[][cols]);
+int zygoteServe(const char *zygote, char *argv[], int (**W)[SIZE], matrixShape *shapeW, costModel *cost);
+int zygoteFork(int sock, char *argv[], int numW, int (**Ws)[SIZE], const matrixShape *shapes, int (**W)[SIZE],
+               matrixShape *shapeW);
+int readRequest(int fd, requestInfo *request);
+void parseBatchPolicy(const char *policy, batchPolicy *batch);
+int readBatch(int fd, requestInfo *requests, batchPolicy *batch);
+void batchReport(const batchPolicy *batch);
+resultCache *cacheOpen(const char *megabytes);
+uint64_t cacheHash(int A[][SIZE]);
+int cacheGet(resultCache *cache, int A[][SIZE], int **R);
+void cachePut(resultCache *cache, int A[][SIZE], int **R);
+void cacheClose(resultCache *cache);
+void deltaReport(int delta, long rowsReused, long rowsChecked);
+int narrowW(int W[][SIZE], matrixShape shape, const char *enabled, int16_t (**W16)[SIZE]);
+int narrowRows(int A[][SIZE], int rows, int inner, int largestW, int16_t A16[][SIZE]);
+int dot16(const int16_t *a, const int16_t *w, int n);
+void narrowReport(int narrow, long rowsNarrow, long rowsComputed);
+double nowUs(void);
+matrixShape readFile(FILE *file, int rows, int cols, int matrix[][cols]);
+matrixShape readMatrixMarket(FILE *file, const char *header, int rows, int cols, int matrix[][cols]);
+csrMatrix *csrFrom(int W[][SIZE], matrixShape shape, const char *density);
+bitMatrix *bitsFrom(int W[][SIZE], matrixShape shape, const char *enabled);
+void csrFree(csrMatrix *csr);
 void printArrayContents(int rows, int cols, int matrix[][cols], char name[]);
-void* computeCell(void* givenData);
+void* computeChunks(void* givenData);
+void computeRows(threadData *data, int first, int last);
+void computeTile(threadData *data, int firstRow, int lastRow, int firstCol, int lastCol);
+void runStealing(const execPlan *plan, threadData *data);
+void* stealRun(void* givenWorker);
+int dequePop(tileDeque *deque, int fromTop);
+void runPlan(const execPlan *plan, threadData *data);
+void loadCostModel(costModel *cost, const char *profile);
+void calibrate(costModel *cost);
+execPlan planFor(const costModel *cost, int policy, int workers, int rows, int cols, int inner);
+int parsePolicy(const char *policy);
+int workerCpu(int worker);
+void pinThread(pthread_attr_t *attr, int worker);
+int availableCores(void);
+void* emptyWorker(void* unused);
+void jobserverOpen(void);
+void jobserverAcquire(void);
+void jobserverRelease(void);
+void parseFlushPolicy(const char *policy, streamWriter *writer);
+void streamWriterStart(streamWriter *writer, const char *wName);
+void streamWriterPush(streamWriter *writer, int iterationNum, const char *name, int **R);
+void streamWriterClose(streamWriter *writer);
+void* streamWriterRun(void* givenWriter);
+resultStore *storeOpen(const char *path, int index);
+int storePut(resultStore *store, int seq, const char *name, int **R);
+void storeClose(resultStore *store);
 
 int main(int argc, char* argv[]) {
-    // Initialize to 0
-    int A[SIZE][SIZE] = {0};
-    int W[SIZE][SIZE] = {0};
+    // What spawning a thread, forking and the kernel cost on this machine, to plan each product from
+    costModel cost;
+    int (*W)[SIZE] = NULL;
+    matrixShape shapeW = {SIZE, SIZE}; // Rows and columns of W that are not padding
+
+    // Set by parent with -z. We are the zygote: load every W once, then fork a worker for each child the
+    // parent asks for. Only the worker returns, with its W already parsed, stdio set up and argv[2] its W name
+    char *zygote = getenv("ZYGOTE");
+    if (zygote) {
+        zygoteServe(zygote, argv, &W, &shapeW, &cost);
+        argc = 3;
+    }
+
+    // Set by parent with -b. Stack the As that are waiting into one [A_1; A_2; ...] x W product
+    batchPolicy batch;
+    parseBatchPolicy(getenv("BATCH"), &batch);
+
+    // Initialize to 0, on the heap since they get big with -DSIZE
+    requestInfo *requests = calloc(batch.maxBatch, sizeof(requestInfo));
+    // Set by parent with -D. Keep the last A and its product, only rows of A that changed are multiplied
+    int delta = getenv("DELTA") && atoi(getenv("DELTA")) > 0;
+    int (*lastA)[SIZE] = delta ? calloc(SIZE, sizeof(int[SIZE])) : NULL;
+    int (*lastR)[SIZE] = delta ? calloc(SIZE, sizeof(int[SIZE])) : NULL;
+    int haveLast = 0;
+    long rowsReused = 0;
+    long rowsChecked = 0;
+    char *reused = calloc((size_t) SIZE * batch.maxBatch, 1); // Row i of A number b is row i of the one before
+
+    int (*stacked)[SIZE] = batch.maxBatch > 1 || delta ? calloc((size_t) batch.maxBatch * SIZE, sizeof(int[SIZE]))
+                                                       : NULL;
+    int **missRows = malloc(sizeof(int *) * SIZE * batch.maxBatch); // Rows of R that are computed
+    int *misses = malloc(sizeof(int) * batch.maxBatch);
+    int count;
     int iterationNum = 0;
+    char *policyName = getenv("POLICY"); // Set by parent. Force serial, threaded or process instead of auto
+    int policy = parsePolicy(policyName);
+    char *workersEnv = getenv("WORKERS"); // Force the number of workers, for the scaling benchmark
+    int workers = workersEnv ? atoi(workersEnv) : 0;
+    char *streamPolicy = getenv("STREAM"); // Set by parent. Stream each product instead of dumping R at EOF
+    streamWriter *writer = NULL;
+    char *storePath = getenv("STORE"); // Set by parent. Also write every product to the result store
+    resultStore *store = NULL;
+    char *resultPipe = getenv("RESULT"); // Set by parent. Pipe used to send each product back to the parent
+    int resultFd = resultPipe ? atoi(resultPipe) : -1;
+    resultCache *cache = cacheOpen(getenv("CACHE_MB")); // Set by parent with -m. Products of As seen before
+
+    // Set by parent with -x spawn. There was no fork of the parent to print the Starting line, so we do
+    char *command = getenv("COMMAND");
+    if (command) {
+        fprintf(stdout, "Starting command %s: child %d pid of parent %d\n", command, getpid(), getppid());
+        if (getenv("PINNED"))
+            fprintf(stdout, "Pinned to cpus %s\n", getenv("PINNED"));
+        fflush(stdout);
+    }
 
     // Check if 3 args are provided
     if (argc != 3) { // argv[0] is program name
@@ -44,63 +450,265 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    // Open, check and read the files, close when done
-    FILE *fileW = fopen(argv[2], "r");
-    checkFile(fileW, argv[2]);
-    readFile(fileW, SIZE, SIZE, W);
-    fclose(fileW);
+    // Open, check and read the files, close when done. A zygote worker has W already
+    if (!zygote) {
+        W = calloc(SIZE, sizeof(int[SIZE]));
+        FILE *fileW = fopen(argv[2], "r");
+        checkFile(fileW, argv[2]);
+        shapeW = readFile(fileW, SIZE, SIZE, W);
+        fclose(fileW);
+    } else if (!W) {
+        checkFile(NULL, argv[2]);
+    }
+    jobserverOpen();
+
+    // A W of only 0 and 1 is packed, a row of A times a column is then an AND and a popcount. Set by parent
+    // with -B 0 to keep it as it is. Packing is only reported when -B, -p or -c asked about it
+    bitMatrix *bitW = bitsFrom(W, shapeW, getenv("BITS"));
+    if (bitW && (getenv("BITS") || policyName || getenv("PROFILE"))) {
+        fprintf(stdout, "Binary W: %d of %d cells are 1, packed into %zu bytes instead of %zu\n", bitW->ones,
+                shapeW.rows * shapeW.cols, sizeof(bitMatrix), MATRIX_SIZE);
+        fflush(stdout);
+    }
+    if (bitW) {
+        free(W); // Only the packed W is used from here on
+        W = NULL;
+    }
+
+    // Set by parent with -S. A mostly 0 W is multiplied from its CSR, only the cells that are not 0. CSR is
+    // only reported when -S, -p or -c asked about it
+    csrMatrix *sparseW = bitW ? NULL : csrFrom(W, shapeW, getenv("SPARSE"));
+    if (sparseW && (getenv("SPARSE") || policyName || getenv("PROFILE"))) {
+        fprintf(stdout, "Sparse W: %d of %d cells are not 0, multiplied in CSR\n", sparseW->nnz,
+                shapeW.rows * shapeW.cols);
+        fflush(stdout);
+    }
+
+    // Set by parent with -N 0 to keep int32. A dense W that fits in int16 is also kept transposed in int16, a
+    // batch whose As fit too is then multiplied 16 bit pairs at a time
+    int16_t (*W16)[SIZE] = NULL;
+    int largestW = bitW || sparseW ? 0 : narrowW(W, shapeW, getenv("NARROW"), &W16);
+    int16_t (*narrowA)[SIZE] = W16 ? malloc(sizeof(int16_t[SIZE]) * SIZE * batch.maxBatch) : NULL;
+    long rowsNarrow = 0;
+    long rowsComputed = 0;
+    // The int16 hit rate is only printed when -N, -p or -c asked about how products are computed
+    int narrowStats = largestW > 0 && (getenv("NARROW") || policyName || getenv("PROFILE"));
+
+    // Set by parent. We are already pinned to our cpus, so are the pages we touch from here on
+    if (getenv("AFFINITY"))
+        pinWorkers = sched_getaffinity(0, sizeof(workerCpus), &workerCpus) == 0;
+
+    // A zygote worker inherits the cost model the zygote measured
+    if (!zygote)
+        loadCostModel(&cost, getenv("PROFILE"));
+    int lastPolicy = -1;
+
+    if (storePath) {
+        char *storeIndex = getenv("STORE_INDEX");
+        store = storeOpen(storePath, storeIndex ? atoi(storeIndex) : 0);
+    }
 
     // declare R as a dynamic array of SIZE * SIZE
     int **R = NULL;
 
     // Initialize mutex
     pthread_mutex_init(&mutex, NULL);
-    pthread_t threads[SIZE][SIZE];
-    threadData data[SIZE][SIZE];
-
-    while (read(STDIN_FILENO, &A, MATRIX_SIZE) > 0) {
-        // Realloc R to be (SIZE * SIZE) * iterationNum
-        int oldSize = SIZE * iterationNum;
-        pthread_mutex_lock(&mutex);
-        R = realloc(R, sizeof(int *) * SIZE * (++iterationNum));
-        // Allocate memory for the new rows
-        for (int i = oldSize; i < SIZE * iterationNum; i++) {
+    threadData data;
+
+    // Streaming keeps SIZE rows of R per A in a batch, handed to the writer after every batch
+    if (streamPolicy) {
+        writer = malloc(sizeof(streamWriter));
+        parseFlushPolicy(streamPolicy, writer);
+        streamWriterStart(writer, argv[2]);
+        R = malloc(sizeof(int *) * SIZE * batch.maxBatch);
+        for (int i = 0; i < SIZE * batch.maxBatch; i++) {
             R[i] = malloc(sizeof(int) * SIZE);
         }
-        pthread_mutex_unlock(&mutex);
+    }
 
-        char filename[100];
-        sprintf(filename, " x %s\n", argv[2]);
-        fprintf(stdout, "%s", filename);
-        fflush(stdout);
+    while ((count = readBatch(STDIN_FILENO, requests, &batch)) > 0) {
+        int first = iterationNum; // Number of As before this batch
+        int rows;
+        if (writer) {
+            iterationNum += count;
+        } else {
+            // Realloc R to be (SIZE * SIZE) * iterationNum
+            int oldSize = SIZE * iterationNum;
+            pthread_mutex_lock(&mutex);
+            iterationNum += count;
+            R = realloc(R, sizeof(int *) * SIZE * iterationNum);
+            // Allocate memory for the new rows
+            for (int i = oldSize; i < SIZE * iterationNum; i++) {
+                R[i] = malloc(sizeof(int) * SIZE);
+            }
+            pthread_mutex_unlock(&mutex);
 
-        // Create threads for each cell
-        for (int i = 0; i < SIZE; i++) {
-            for (int j = 0; j < SIZE; j++) {
-                data[i][j].row = i;
-                data[i][j].col = j;
-                data[i][j].A = A;
-                data[i][j].W = W;
-                data[i][j].R = R;
-                data[i][j].iterationNum = iterationNum;
-                pthread_create(&threads[i][j], NULL, computeCell, &data[i][j]);
+            // Log the A filename from each request, so PID.out is in the order the requests arrived
+            for (int b = 0; b < count; b++)
+                fprintf(stdout, "%s x %s\n", requests[b].name, argv[2]);
+            fflush(stdout);
+        }
+
+        // As in the cache already have their product, the rest are computed. With delta only the rows that
+        // differ from the A before are, the others are copied from its product once that is done. Rows past
+        // the end of the A file are 0 in the product, only the columns the As really have are multiplied
+        int numMisses = 0;
+        int inner = 0;
+        rows = 0;
+        for (int b = 0; b < count; b++) {
+            int **product = writer ? R + SIZE * b : R + SIZE * (first + b);
+            if (cache && cacheGet(cache, requests[b].A, product))
+                continue;
+            int (*prevA)[SIZE] = b > 0 ? requests[b - 1].A : lastA;
+            int copied = 0; // Rows of the A file copied from the product before, padding rows do not count
+            for (int i = 0; i < SIZE; i++) {
+                reused[SIZE * b + i] = delta && (b > 0 || haveLast) &&
+                                       memcmp(requests[b].A[i], prevA[i], sizeof(int) * SIZE) == 0;
+                if (reused[SIZE * b + i]) {
+                    copied += i < requests[b].shape.rows;
+                    continue;
+                }
+                if (i >= requests[b].shape.rows) {
+                    memset(product[i], 0, sizeof(int) * SIZE);
+                    continue;
+                }
+                if (stacked)
+                    memcpy(stacked[rows], requests[b].A[i], sizeof(int) * SIZE);
+                missRows[rows++] = product[i];
             }
+            if (delta) {
+                rowsChecked += requests[b].shape.rows;
+                rowsReused += copied;
+            }
+            if (requests[b].shape.cols > inner)
+                inner = requests[b].shape.cols;
+            misses[numMisses++] = b;
         }
+        if (inner > shapeW.rows)
+            inner = shapeW.rows; // Columns of A past the rows of W multiply 0
 
-        // Join threads
-        for (int i = 0; i < SIZE; i++) {
-            for (int j = 0; j < SIZE; j++) {
-                pthread_join(threads[i][j], NULL);
+        // A batch is one rows x inner by inner x cols product, so the plan is made for all of it at once. In
+        // CSR each row of A costs one multiply-add per cell of W that is not 0
+        int planInner = sparseW ? (sparseW->nnz + shapeW.cols - 1) / shapeW.cols : inner;
+        if (bitW)
+            planInner = (bitW->ones + shapeW.cols - 1) / shapeW.cols; // At most one add per 1, less for a 0/1 A
+        execPlan plan = planFor(&cost, policy, workers, rows, shapeW.cols, planInner);
+        if (rows > 0 && policyName && plan.policy != lastPolicy) {
+            int stealing = plan.policy == POLICY_THREADED && SIZE >= STEAL_MIN_SIZE;
+            fprintf(stdout, "Plan for %dx%d: %s, %d workers, %d %s (thread %.1f us, fork %.1f us, "
+                            "madd %.3f ns, %d cores)\n", rows, shapeW.cols, policyNames[plan.policy], plan.workers,
+                    stealing ? TILE : plan.grain, stealing ? "square tiles stolen" : "rows per chunk",
+                    cost.threadUs, cost.forkUs, cost.maddNs, cost.cores);
+            fflush(stdout);
+            lastPolicy = plan.policy;
+        }
+        if (rows > 0) {
+            // Row r of the stacked product is the r-th computed row, one A's rows when there is nothing to stack
+            data.A = stacked ? stacked : requests[misses[0]].A;
+            data.W = W;
+            data.sparseW = sparseW;
+            data.bitW = bitW;
+            data.W16 = W16;
+            data.A16 = W16 && narrowRows(data.A, rows, inner, largestW, narrowA) ? narrowA : NULL;
+            rowsNarrow += data.A16 ? rows : 0;
+            rowsComputed += rows;
+            data.R = missRows;
+            data.rows = rows;
+            data.cols = shapeW.cols;
+            data.inner = inner;
+            data.offset = 0;
+            data.grain = plan.grain;
+            data.nextRow = 0;
+            runPlan(&plan, &data);
+        }
+
+        // In order, so the product a row is copied from is complete
+        for (int m = 0; m < numMisses; m++) {
+            int b = misses[m];
+            int **product = writer ? R + SIZE * b : R + SIZE * (first + b);
+            int **prevProduct = product - SIZE; // The batch's products are next to each other in R
+            for (int i = 0; delta && i < SIZE; i++) {
+                if (reused[SIZE * b + i])
+                    memcpy(product[i], b > 0 ? prevProduct[i] : lastR[i], sizeof(int) * SIZE);
             }
+            if (cache)
+                cachePut(cache, requests[b].A, product);
+        }
+        if (delta) {
+            int **product = writer ? R + SIZE * (count - 1) : R + SIZE * (iterationNum - 1);
+            memcpy(lastA, requests[count - 1].A, MATRIX_SIZE);
+            for (int i = 0; i < SIZE; i++)
+                memcpy(lastR[i], product[i], sizeof(int) * SIZE);
+            haveLast = 1;
         }
 
-        // Zero out A
-        memset(A, 0, MATRIX_SIZE);
+        // Split the product back into one SIZE row product per request
+        for (int b = 0; b < count; b++) {
+            requestInfo *request = &requests[b];
+            int **product = writer ? R + SIZE * b : R + SIZE * (first + b);
+
+            // Record the product at its fixed slot in the result store, stop using it once it cannot grow
+            if (store && storePut(store, request->seq, request->name, product) < 0) {
+                storeClose(store);
+                store = NULL;
+            }
+
+            // Send the product back to the parent with its request number
+            if (resultFd >= 0) {
+                resultInfo *result = malloc(sizeof(resultInfo));
+                result->seq = request->seq;
+                for (int i = 0; i < SIZE; i++)
+                    memcpy(result->R[i], product[i], sizeof(int) * SIZE);
+                write(resultFd, result, sizeof(resultInfo));
+                free(result);
+            }
+
+            // Hand the product to the writer, blocks only if RING_SLOTS products are still unwritten
+            if (writer)
+                streamWriterPush(writer, first + b + 1, request->name, product);
+
+            // Zero out A
+            memset(request->A, 0, MATRIX_SIZE);
+        }
 
         fflush(stdin);
-        fflush(stdout);
+        if (!writer)
+            fflush(stdout);
+
+    }
+
+    if (store)
+        storeClose(store);
+    free(missRows);
+    free(misses);
+    free(reused);
+    free(lastA);
+    free(lastR);
+    csrFree(sparseW);
+    free(bitW);
+    free(W16);
+    free(narrowA);
 
+    if (writer) {
+        streamWriterClose(writer);
+        free(writer);
+        fprintf(stdout, "\nStreamed %d A matrices\n", iterationNum);
+        batchReport(&batch);
+        cacheClose(cache);
+        deltaReport(delta, rowsReused, rowsChecked);
+        narrowReport(narrowStats, rowsNarrow, rowsComputed);
+        fflush(stdout);
+        for (int i = 0; i < SIZE * batch.maxBatch; i++) {
+            free(R[i]);
+        }
+        free(R);
+        free(requests);
+        free(stacked);
+        free(W);
+        pthread_mutex_destroy(&mutex);
+        return 0;
     }
+
     pthread_mutex_lock(&mutex);
     fprintf(stdout, "\nrMatrix for %d A matrices=[\n", iterationNum);
     fflush(stdout);
@@ -110,6 +718,10 @@ int main(int argc, char* argv[]) {
         fprintf(stdout, "\n");
     }
     fprintf(stdout, "]\n");
+    batchReport(&batch);
+    cacheClose(cache);
+    deltaReport(delta, rowsReused, rowsChecked);
+    narrowReport(narrowStats, rowsNarrow, rowsComputed);
     fflush(stdout);
     pthread_mutex_unlock(&mutex);
     pthread_mutex_destroy(&mutex);
@@ -119,6 +731,9 @@ int main(int argc, char* argv[]) {
         free(R[i]);
     }
     free(R);
+    free(requests);
+    free(stacked);
+    free(W);
 
     return 0;
 }
@@ -141,16 +756,23 @@ void checkFile(FILE *file, const char *filename) {
  * This function reads the file and populates the given matrix.
  * Assumption: file has been checked, matrix is already initialized, and rows and columns are known
  * Input parameters: FILE *file, int rows, int cols, int matrix[][cols]
- * Returns: void, updates matrix by reference
+ * Returns: matrixShape, the rows and the widest row the file has (at most rows x cols), updates matrix by reference
 */
-void readFile(FILE *file, int rows, int cols, int matrix[][cols]) {
+matrixShape readFile(FILE *file, int rows, int cols, int matrix[][cols]) {
     // Initialize row and column counters
     size_t i = 0;
     size_t j = 0;
+    matrixShape shape = {0, 0};
 
     // Read the file line by line
-    char buf[100];
-    while (fgets(buf, sizeof(buf), file) != NULL) {
+    char *buf = malloc(LINE_SIZE);
+    while (fgets(buf, LINE_SIZE, file) != NULL) {
+
+        // A Matrix Market file says so on its first line, the rest of it is read differently
+        if (i == 0 && strncmp(buf, "%%MatrixMarket", 14) == 0) {
+            shape = readMatrixMarket(file, buf, rows, cols, matrix);
+            break;
+        }
 
         // Remove trailing newline character
         if (buf[strlen(buf) - 1] == '\n') buf[strlen(buf) - 1] = '\0';
@@ -165,9 +787,144 @@ void readFile(FILE *file, int rows, int cols, int matrix[][cols]) {
             token = strtok(NULL, " "); // Last one
         }
 
+        // Remember the extent of what was read, a blank line does not count as a row
+        if (j > 0 && i < rows)
+            shape.rows = (int) i + 1;
+        if (j > shape.cols)
+            shape.cols = (int) j;
         i++; // Next row
         j = 0; // Reset column count for the new row
     }
+    free(buf);
+    return shape;
+}
+
+/*
+ * This function reads the rest of a Matrix Market (.mtx) file after readFile has read its header line
+ * Assumption: coordinate or array format, integer, real (cut to int) or pattern values, general, symmetric or
+ *             skew-symmetric. Indexes in the file start at 1, cells past rows x cols are ignored. Array
+ *             symmetric and skew-symmetric files hold only the lower triangle, a column at a time
+ * Input parameters: FILE *file, const char *header, int rows, int cols, int matrix[][cols]
+ * Returns: matrixShape, the size line of the file cut to rows x cols, updates matrix by reference
+*/
+matrixShape readMatrixMarket(FILE *file, const char *header, int rows, int cols, int matrix[][cols]) {
+    char format[16] = "", field[16] = "", symmetry[16] = "";
+    matrixShape shape = {0, 0};
+    long m = 0, n = 0, entries = 0;
+    sscanf(header, "%%%%MatrixMarket %*s %15s %15s %15s", format, field, symmetry);
+    int coordinate = strcmp(format, "coordinate") == 0;
+    int pattern = strcmp(field, "pattern") == 0;
+    int mirror = strcmp(symmetry, "general") == 0 ? 0 : strcmp(symmetry, "skew-symmetric") == 0 ? -1 : 1;
+
+    char *buf = malloc(LINE_SIZE);
+    // Next cell in array format, a column at a time. Symmetric files list only the lower triangle of each
+    // column and skew-symmetric ones leave out the diagonal too, so column j starts at row j or j + 1
+    long row = mirror < 0, col = 0;
+    while (fgets(buf, LINE_SIZE, file) != NULL) {
+        if (buf[0] == '%' || buf[strspn(buf, " \t\r\n")] == '\0')
+            continue; // Comments and blank lines
+        if (m == 0) {
+            if (sscanf(buf, "%ld %ld %ld", &m, &n, &entries) < 2)
+                break;
+            shape.rows = m < rows ? (int) m : rows;
+            shape.cols = n < cols ? (int) n : cols;
+            continue;
+        }
+
+        long i, j;
+        double value = 1;
+        if (coordinate) {
+            if (sscanf(buf, "%ld %ld %lf", &i, &j, &value) < (pattern ? 2 : 3))
+                continue;
+            i--;
+            j--;
+        } else {
+            if (sscanf(buf, "%lf", &value) != 1)
+                continue;
+            i = row;
+            j = col;
+            if (++row == m) {
+                col++;
+                row = mirror == 0 ? 0 : col + (mirror < 0);
+            }
+        }
+        if (i >= 0 && j >= 0 && i < rows && j < cols)
+            matrix[i][j] = (int) value;
+        if (mirror && i != j && j < rows && i < cols && i >= 0 && j >= 0)
+            matrix[j][i] = (int) value * mirror;
+    }
+    free(buf);
+    return shape;
+}
+
+/*
+ * This function keeps W in CSR if few enough of its cells are not 0 for CSR to be faster
+ * Assumption: density is the SPARSE variable or NULL for SPARSE_DENSITY, 0 never uses CSR and 1 always does
+ * Input parameters: int W[][SIZE], matrixShape shape, const char *density
+ * Returns: csrMatrix *, NULL if W is dense enough to multiply as it is
+*/
+csrMatrix *csrFrom(int W[][SIZE], matrixShape shape, const char *density) {
+    double most = density ? atof(density) : SPARSE_DENSITY;
+    int nnz = 0;
+    for (int k = 0; k < shape.rows; k++)
+        for (int c = 0; c < shape.cols; c++)
+            nnz += W[k][c] != 0;
+    if (most <= 0 || shape.rows == 0 || nnz > most * shape.rows * shape.cols)
+        return NULL;
+
+    csrMatrix *csr = malloc(sizeof(csrMatrix));
+    csr->rows = shape.rows;
+    csr->nnz = 0;
+    csr->col = malloc(sizeof(int) * (nnz > 0 ? nnz : 1));
+    csr->val = malloc(sizeof(int) * (nnz > 0 ? nnz : 1));
+    for (int k = 0; k <= SIZE; k++) {
+        csr->rowStart[k] = csr->nnz;
+        for (int c = 0; k < shape.rows && c < shape.cols; c++) {
+            if (W[k][c] != 0) {
+                csr->col[csr->nnz] = c;
+                csr->val[csr->nnz++] = W[k][c];
+            }
+        }
+    }
+    return csr;
+}
+
+/*
+ * This function packs W a column at a time if every one of its cells is 0 or 1
+ * Assumption: enabled is the BITS variable, NULL or anything but 0 packs a 0/1 W
+ * Input parameters: int W[][SIZE], matrixShape shape, const char *enabled
+ * Returns: bitMatrix *, NULL if W has another value or packing is turned off
+*/
+bitMatrix *bitsFrom(int W[][SIZE], matrixShape shape, const char *enabled) {
+    if ((enabled && atoi(enabled) == 0) || shape.rows == 0)
+        return NULL;
+    for (int k = 0; k < shape.rows; k++)
+        for (int c = 0; c < shape.cols; c++)
+            if (W[k][c] & ~1)
+                return NULL;
+
+    bitMatrix *bits = calloc(1, sizeof(bitMatrix));
+    for (int k = 0; k < shape.rows; k++) {
+        for (int c = 0; c < shape.cols; c++) {
+            bits->cols[c][k / 64] |= (uint64_t) W[k][c] << (k % 64);
+            bits->ones += W[k][c];
+        }
+    }
+    return bits;
+}
+
+/*
+ * This function frees a CSR matrix from csrFrom
+ * Assumption: csr may be NULL
+ * Input parameters: csrMatrix *csr
+ * Returns: void
+*/
+void csrFree(csrMatrix *csr) {
+    if (!csr)
+        return;
+    free(csr->col);
+    free(csr->val);
+    free(csr);
 }
 
 /*
@@ -194,28 +951,1322 @@ void printArrayContents(int rows, int cols, int matrix[][cols], char name[]) {
 }
 
 /*
- * This function computes a single cell.
- * Assumption: To be ran as a thread.
- * Input parameters: FILE *file, const char *filename
- * Returns: void, exits if needed
+ * This function reads one whole request from the parent's pipe, a big -DSIZE request takes several reads
+ * Assumption: fd is the blocking end of the parent's pipe
+ * Input parameters: int fd, requestInfo *request
+ * Returns: int (1) with request filled in, (0) at EOF
 */
-void* computeCell(void* givenData) {
-    // pthread_create throws a fit if not a void then cast correctly within the function
-    threadData *data = (threadData*) givenData;
-    int r = data->row;
-    int c = data->col;
-    int offset = (SIZE * (data->iterationNum - 1));
+int readRequest(int fd, requestInfo *request) {
+    size_t got = 0;
+    while (got < sizeof(requestInfo)) {
+        ssize_t n = read(fd, (char *) request + got, sizeof(requestInfo) - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        got += n;
+    }
+    return 1;
+}
+
+/*
+ * This function parses the BATCH policy, e.g. "16", "500us" or "16,500us"
+ * Assumption: A bare number is the largest batch, a number ending in us is the longest wait for more As
+ * Input parameters: const char *policy, batchPolicy *batch
+ * Returns: void, fills batch by reference (one A at a time, no waiting, if policy is NULL)
+*/
+void parseBatchPolicy(const char *policy, batchPolicy *batch) {
+    memset(batch, 0, sizeof(batchPolicy));
+    batch->maxWaitUs = policy ? BATCH_WAIT_US : 0;
+
+    const char *p = policy ? policy : "";
+    while (*p) {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p) break; // Not a number, stop parsing
+        if (strncmp(end, "us", 2) == 0) {
+            batch->maxWaitUs = value > 0 ? value : 0;
+            end += 2;
+        } else {
+            batch->maxBatch = (int) value;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    if (batch->maxBatch <= 0)
+        batch->maxBatch = policy ? BATCH_MAX : 1;
+}
+
+/*
+ * This function reads the next batch of requests. It blocks for the first one, then takes every request that
+ * is already in the pipe. While the batch is smaller than the As expected within maxWaitUs at the current
+ * arrival rate, it waits for more until the first A has waited that long, whichever comes first
+ * Assumption: requests has room for batch->maxBatch requests
+ * Input parameters: int fd, requestInfo *requests, batchPolicy *batch
+ * Returns: int the number of requests read, (0) at EOF
+*/
+int readBatch(int fd, requestInfo *requests, batchPolicy *batch) {
+    if (!readRequest(fd, &requests[0]))
+        return 0;
+    if (batch->maxBatch == 1)
+        return 1; // Not batching, not even the clock is read
+
+    // Each A moves the average gap 1/8 of the way to its own gap
+    double arrival = nowUs();
+    if (batch->lastArrival > 0)
+        batch->gapUs += ((arrival - batch->lastArrival) - batch->gapUs) / 8;
+    batch->lastArrival = arrival;
+
+    // As many As as are expected within the longest wait, no wait at all if the next one is not
+    int target = batch->maxBatch;
+    if (batch->gapUs > 0 && batch->maxWaitUs / batch->gapUs + 1 < target)
+        target = (int) (batch->maxWaitUs / batch->gapUs) + 1;
+    double fillUs = batch->gapUs * (target - 1); // Expected time until the batch is full
+    double deadline = arrival + (fillUs < batch->maxWaitUs ? fillUs : batch->maxWaitUs);
+
+    int count = 1;
+    while (count < batch->maxBatch) {
+        // As that are already here are free to take, only wait while the batch is under target
+        double now = nowUs();
+        double waitUs = count < target && now < deadline ? deadline - now : 0;
+        long us = (long) waitUs;
+        struct timespec timeout = {us / 1000000, (us % 1000000) * 1000};
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = ppoll(&pfd, 1, &timeout, NULL);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        batch->waitedUs += nowUs() - now;
+        if (ready <= 0 || !(pfd.revents & (POLLIN | POLLHUP)))
+            break;
+        if (!readRequest(fd, &requests[count]))
+            break; // EOF, the next readBatch returns 0
+
+        arrival = nowUs();
+        batch->gapUs += ((arrival - batch->lastArrival) - batch->gapUs) / 8;
+        batch->lastArrival = arrival;
+        count++;
+    }
+
+    batch->batches++;
+    batch->requests += count;
+    if (count > batch->largest)
+        batch->largest = count;
+    return count;
+}
+
+/*
+ * This function prints how the As were batched
+ * Assumption: Called once at exit, prints nothing if BATCH was not set
+ * Input parameters: const batchPolicy *batch
+ * Returns: void
+*/
+void batchReport(const batchPolicy *batch) {
+    if (batch->maxBatch == 1)
+        return;
+    fprintf(stdout, "Batched %ld A matrices in %ld batches: average %.1f, largest %d of %d, waited %.1f ms, "
+                    "gap %.1f us\n", batch->requests, batch->batches,
+            batch->batches ? (double) batch->requests / batch->batches : 0.0, batch->largest, batch->maxBatch,
+            batch->waitedUs / 1000.0, batch->gapUs);
+}
+
+/*
+ * This function creates the result cache with as many entries as fit in the given number of MB
+ * Assumption: NULL, 0 or less than one entry means no cache
+ * Input parameters: const char *megabytes (CACHE_MB)
+ * Returns: resultCache *, NULL if there is no cache
+*/
+resultCache *cacheOpen(const char *megabytes) {
+    size_t capacity = megabytes ? (size_t) (atof(megabytes) * 1024 * 1024) / sizeof(cacheEntry) : 0;
+    if (capacity == 0)
+        return NULL;
+
+    resultCache *cache = calloc(1, sizeof(resultCache));
+    cache->capacity = capacity;
+    cache->numBuckets = 1;
+    while (cache->numBuckets < capacity) // About one entry per bucket once full
+        cache->numBuckets *= 2;
+    cache->buckets = calloc(cache->numBuckets, sizeof(cacheEntry *));
+    return cache;
+}
+
+/*
+ * This function hashes an A matrix with 64 bit FNV-1a over its bytes
+ * Assumption: none
+ * Input parameters: int A[][SIZE]
+ * Returns: uint64_t
+*/
+uint64_t cacheHash(int A[][SIZE]) {
+    const unsigned char *bytes = (const unsigned char *) A;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < MATRIX_SIZE; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * This function looks A up in the cache and copies its product out on a hit
+ * Assumption: R has SIZE rows
+ * Input parameters: resultCache *cache, int A[][SIZE], int **R
+ * Returns: int (1) on a hit with R filled in, (0) on a miss
+*/
+int cacheGet(resultCache *cache, int A[][SIZE], int **R) {
+    uint64_t hash = cacheHash(A);
+    cacheEntry *entry = cache->buckets[hash & (cache->numBuckets - 1)];
+    while (entry && (entry->hash != hash || memcmp(entry->A, A, MATRIX_SIZE) != 0))
+        entry = entry->chain;
+    if (!entry) {
+        cache->misses++;
+        return 0;
+    }
+
+    // Move it to the head of the LRU list
+    if (entry != cache->newest) {
+        entry->newer->older = entry->older;
+        if (entry->older)
+            entry->older->newer = entry->newer;
+        else
+            cache->oldest = entry->newer;
+        entry->newer = NULL;
+        entry->older = cache->newest;
+        cache->newest->newer = entry;
+        cache->newest = entry;
+    }
+
+    for (int i = 0; i < SIZE; i++)
+        memcpy(R[i], entry->R[i], sizeof(int) * SIZE);
+    cache->hits++;
+    return 1;
+}
+
+/*
+ * This function adds the product of A to the cache, evicting the least recently used one if it is full
+ * Assumption: R has SIZE rows. A batch can have the same A twice, then the second one is already there
+ * Input parameters: resultCache *cache, int A[][SIZE], int **R
+ * Returns: void
+*/
+void cachePut(resultCache *cache, int A[][SIZE], int **R) {
+    uint64_t hash = cacheHash(A);
+    cacheEntry *entry = cache->buckets[hash & (cache->numBuckets - 1)];
+    while (entry && (entry->hash != hash || memcmp(entry->A, A, MATRIX_SIZE) != 0))
+        entry = entry->chain;
+    if (entry)
+        return;
+
+    if (cache->count < cache->capacity) {
+        entry = malloc(sizeof(cacheEntry));
+        cache->count++;
+    } else {
+        // Reuse the oldest entry, unlink it from its bucket and the LRU list
+        entry = cache->oldest;
+        cacheEntry **link = &cache->buckets[entry->hash & (cache->numBuckets - 1)];
+        while (*link != entry)
+            link = &(*link)->chain;
+        *link = entry->chain;
+        cache->oldest = entry->newer;
+        if (cache->oldest)
+            cache->oldest->older = NULL;
+        else
+            cache->newest = NULL;
+        cache->evictions++;
+    }
+
+    entry->hash = hash;
+    memcpy(entry->A, A, MATRIX_SIZE);
+    for (int i = 0; i < SIZE; i++)
+        memcpy(entry->R[i], R[i], sizeof(int) * SIZE);
+    cacheEntry **bucket = &cache->buckets[entry->hash & (cache->numBuckets - 1)];
+    entry->chain = *bucket;
+    *bucket = entry;
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest)
+        cache->newest->newer = entry;
+    else
+        cache->oldest = entry;
+    cache->newest = entry;
+}
+
+/*
+ * This function prints the hit rate and what the hits saved, then frees the cache
+ * Assumption: Called once at exit, does nothing if there is no cache
+ * Input parameters: resultCache *cache
+ * Returns: void
+*/
+void cacheClose(resultCache *cache) {
+    if (!cache)
+        return;
+    long lookups = cache->hits + cache->misses;
+    fprintf(stdout, "Cache: %ld hits of %ld (%.1f%%), %.1f KB of products and %ld multiply-adds not "
+                    "recomputed, %zu of %zu entries used, %ld evicted\n", cache->hits, lookups,
+            lookups ? 100.0 * cache->hits / lookups : 0.0, cache->hits * (double) MATRIX_SIZE / 1024,
+            cache->hits * (long) SIZE * SIZE * SIZE, cache->count, cache->capacity, cache->evictions);
+
+    cacheEntry *entry = cache->newest;
+    while (entry) {
+        cacheEntry *older = entry->older;
+        free(entry);
+        entry = older;
+    }
+    free(cache->buckets);
+    free(cache);
+}
+
+/*
+ * This function prints how many rows of A were the same as in the A before, their products were copied
+ * Assumption: Called once at exit, prints nothing without DELTA
+ * Input parameters: int delta, long rowsReused, long rowsChecked
+ * Returns: void
+*/
+void deltaReport(int delta, long rowsReused, long rowsChecked) {
+    if (!delta)
+        return;
+    fprintf(stdout, "Delta: %ld of %ld rows reused (%.1f%%)\n", rowsReused, rowsChecked,
+            rowsChecked ? 100.0 * rowsReused / rowsChecked : 0.0);
+}
+
+/*
+ * This function keeps a transposed int16 copy of W if every cell fits in an int16
+ * Assumption: enabled is the NARROW variable, NULL or anything but 0 narrows a W that fits
+ * Input parameters: int W[][SIZE], matrixShape shape, const char *enabled, int16_t (**W16)[SIZE]
+ * Returns: int, the largest absolute value in W (at least 1) with *W16 set, (0) if a cell does not fit or
+ *          narrowing is turned off
+*/
+int narrowW(int W[][SIZE], matrixShape shape, const char *enabled, int16_t (**W16)[SIZE]) {
+    if ((enabled && atoi(enabled) == 0) || shape.rows == 0)
+        return 0;
+    int most = 0;
+    for (int k = 0; k < shape.rows; k++) {
+        for (int c = 0; c < shape.cols; c++) {
+            if (W[k][c] < INT16_MIN || W[k][c] > INT16_MAX)
+                return 0;
+            int value = W[k][c] < 0 ? -W[k][c] : W[k][c];
+            if (value > most)
+                most = value;
+        }
+    }
+
+    *W16 = calloc(SIZE, sizeof(int16_t[SIZE]));
+    for (int k = 0; k < shape.rows; k++)
+        for (int c = 0; c < shape.cols; c++)
+            (*W16)[c][k] = (int16_t) W[k][c];
+    return most > 0 ? most : 1;
+}
+
+/*
+ * This function narrows the rows of A that are computed to int16, if they fit and no cell of the product can
+ * overflow an int32: inner * |A| * |W| is the most any sum of products can add up to, partial sums included
+ * Assumption: A16 has room for rows rows, only the first inner columns are used
+ * Input parameters: int A[][SIZE], int rows, int inner, int largestW, int16_t A16[][SIZE]
+ * Returns: int (1) with A16 filled in, (0) if the batch has to be multiplied in int32
+*/
+int narrowRows(int A[][SIZE], int rows, int inner, int largestW, int16_t A16[][SIZE]) {
+    int most = 0;
+    for (int r = 0; r < rows; r++) {
+        for (int k = 0; k < inner; k++) {
+            if (A[r][k] < INT16_MIN || A[r][k] > INT16_MAX)
+                return 0;
+            int value = A[r][k] < 0 ? -A[r][k] : A[r][k];
+            if (value > most)
+                most = value;
+        }
+    }
+    if ((int64_t) inner * most * largestW > INT32_MAX)
+        return 0;
+
+    for (int r = 0; r < rows; r++)
+        for (int k = 0; k < inner; k++)
+            A16[r][k] = (int16_t) A[r][k];
+    return 1;
+}
 
-    // Compute the cell value
+/*
+ * This function is the dot product of n int16 pairs
+ * Assumption: narrowRows has checked the sum fits in an int32
+ * Input parameters: const int16_t *a, const int16_t *w, int n
+ * Returns: int, the sum of a[k] * w[k]
+*/
+int dot16(const int16_t *a, const int16_t *w, int n) {
     int sum = 0;
-    for (int k = 0; k < SIZE; k++) {
-        sum += data->A[r][k] * data->W[k][c];
+    int k = 0;
+#ifdef __SSE2__
+    // 8 pairs at a time, multiplied into 32 bits and added two by two into 4 lanes
+    __m128i lanes = _mm_setzero_si128();
+    for (; k + 8 <= n; k += 8)
+        lanes = _mm_add_epi32(lanes, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) (a + k)),
+                                                    _mm_loadu_si128((const __m128i *) (w + k))));
+    lanes = _mm_add_epi32(lanes, _mm_shuffle_epi32(lanes, _MM_SHUFFLE(1, 0, 3, 2)));
+    lanes = _mm_add_epi32(lanes, _mm_shuffle_epi32(lanes, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_cvtsi128_si32(lanes);
+#endif
+    for (; k < n; k++) // What is left, or all of it without SSE2
+        sum += a[k] * w[k];
+    return sum;
+}
+
+/*
+ * This function prints how many of the computed rows were multiplied in int16
+ * Assumption: Only printed if W fit in int16 and NARROW, POLICY or PROFILE was set
+ * Input parameters: int narrow, long rowsNarrow, long rowsComputed
+ * Returns: void
+*/
+void narrowReport(int narrow, long rowsNarrow, long rowsComputed) {
+    if (!narrow)
+        return;
+    fprintf(stdout, "Narrow: %ld of %ld rows multiplied in int16 (%.1f%%)\n", rowsNarrow, rowsComputed,
+            rowsComputed ? 100.0 * rowsNarrow / rowsComputed : 0.0);
+}
+
+/*
+ * This function reads the monotonic clock
+ * Assumption: none
+ * Input parameters: none
+ * Returns: double, microseconds
+*/
+double nowUs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/*
+ * This function computes rows first..last-1 of a product
+ * Assumption: No other worker has these rows, so R needs no lock
+ * Input parameters: threadData *data, int first, int last
+ * Returns: void, fills R by reference
+*/
+void computeRows(threadData *data, int first, int last) {
+    computeTile(data, first, last, 0, SIZE);
+}
+
+/*
+ * This function computes the cells of rows firstRow..lastRow-1 and columns firstCol..lastCol-1
+ * Assumption: No other worker has these cells, so R needs no lock
+ * Input parameters: threadData *data, int firstRow, int lastRow, int firstCol, int lastCol
+ * Returns: void, fills R by reference
+*/
+void computeTile(threadData *data, int firstRow, int lastRow, int firstCol, int lastCol) {
+    const bitMatrix *bits = data->bitW;
+    if (bits) {
+        int lastComputed = lastCol < data->cols ? lastCol : data->cols; // Columns past W's are padding
+        for (int r = firstRow; r < lastRow; r++) {
+            int *row = data->R[r + data->offset];
+            // Pack the row of A too if it is only 0 and 1, each cell is then the 1s the row and column share
+            uint64_t packed[BIT_WORDS] = {0};
+            int binary = 1;
+            for (int k = 0; k < data->inner && binary; k++) {
+                binary = (data->A[r][k] & ~1) == 0;
+                packed[k / 64] |= (uint64_t) (data->A[r][k] & 1) << (k % 64);
+            }
+            for (int c = firstCol; c < lastComputed; c++) {
+                int sum = 0;
+                for (int w = 0; w < BIT_WORDS; w++) {
+                    if (binary) {
+                        sum += __builtin_popcountll(packed[w] & bits->cols[c][w]);
+                        continue;
+                    }
+                    // Otherwise add up the cells of A where the column has a 1
+                    for (uint64_t ones = bits->cols[c][w]; ones; ones &= ones - 1)
+                        sum += data->A[r][w * 64 + __builtin_ctzll(ones)];
+                }
+                row[c] = sum;
+            }
+            for (int c = lastComputed > firstCol ? lastComputed : firstCol; c < lastCol; c++)
+                row[c] = 0;
+        }
+        return;
     }
 
-    // Lock before modifying R
-    pthread_mutex_lock(&mutex);
-    data->R[r + offset][c] = sum;
-    pthread_mutex_unlock(&mutex);
+    if (data->A16) {
+        // Each cell is a dot product of a row of A and a column of W, both int16 and next to each other
+        int lastComputed = lastCol < data->cols ? lastCol : data->cols; // Columns past W's are padding
+        for (int r = firstRow; r < lastRow; r++) {
+            int *row = data->R[r + data->offset];
+            for (int c = firstCol; c < lastComputed; c++)
+                row[c] = dot16(data->A16[r], data->W16[c], data->inner);
+            for (int c = lastComputed > firstCol ? lastComputed : firstCol; c < lastCol; c++)
+                row[c] = 0;
+        }
+        return;
+    }
 
+    const csrMatrix *csr = data->sparseW;
+    if (csr) {
+        // Row r of the product is the sum of the CSR rows of W scaled by A[r][k], only W's cells that are not 0
+        for (int r = firstRow; r < lastRow; r++) {
+            int *row = data->R[r + data->offset];
+            memset(row + firstCol, 0, sizeof(int) * (lastCol - firstCol));
+            for (int k = 0; k < data->inner; k++) {
+                int a = data->A[r][k];
+                if (a == 0)
+                    continue;
+                for (int n = csr->rowStart[k]; n < csr->rowStart[k + 1]; n++) {
+                    int c = csr->col[n];
+                    if (c >= lastCol)
+                        break; // Columns are in order, the rest are in another tile
+                    if (c >= firstCol)
+                        row[c] += a * csr->val[n];
+                }
+            }
+        }
+        return;
+    }
+
+    int lastComputed = lastCol < data->cols ? lastCol : data->cols; // Columns past W's are padding
+    for (int r = firstRow; r < lastRow; r++) {
+        int *row = data->R[r + data->offset];
+        for (int c = firstCol; c < lastComputed; c++) {
+            // Compute the cell value
+            int sum = 0;
+            for (int k = 0; k < data->inner; k++) {
+                sum += data->A[r][k] * data->W[k][c];
+            }
+            row[c] = sum;
+        }
+        for (int c = lastComputed > firstCol ? lastComputed : firstCol; c < lastCol; c++)
+            row[c] = 0;
+    }
+}
+
+/*
+ * This function is a worker, it takes chunks of grain rows until the product is done
+ * Assumption: To be ran as a thread, or in a forked worker with data in shared memory
+ * Input parameters: void* givenData (a threadData)
+ * Returns: NULL
+*/
+void* computeChunks(void* givenData) {
+    // pthread_create throws a fit if not a void then cast correctly within the function
+    threadData *data = (threadData*) givenData;
+    int first;
+
+    while ((first = __atomic_fetch_add(&data->nextRow, data->grain, __ATOMIC_RELAXED)) < data->rows) {
+        int last = first + data->grain < data->rows ? first + data->grain : data->rows;
+        // Compute the chunk, only while holding a token
+        jobserverAcquire();
+        computeRows(data, first, last);
+        jobserverRelease();
+    }
     return NULL; // Nullptr
-}
\ No newline at end of file
+}
+
+/*
+ * This function computes one product the way the plan says
+ * Assumption: data is filled in with nextRow 0
+ * Input parameters: const execPlan *plan, threadData *data
+ * Returns: void, fills R by reference
+*/
+void runPlan(const execPlan *plan, threadData *data) {
+    if (plan->policy == POLICY_SERIAL) {
+        data->grain = data->rows;
+        computeChunks(data);
+        return;
+    }
+
+    if (plan->policy == POLICY_THREADED && SIZE >= STEAL_MIN_SIZE) {
+        runStealing(plan, data);
+        return;
+    }
+
+    if (plan->policy == POLICY_THREADED) {
+        pthread_t threads[plan->workers];
+        for (int i = 0; i < plan->workers; i++) {
+            pthread_attr_t attr;
+            pinThread(&attr, i);
+            pthread_create(&threads[i], &attr, computeChunks, data);
+            pthread_attr_destroy(&attr);
+        }
+        for (int i = 0; i < plan->workers; i++)
+            pthread_join(threads[i], NULL);
+        return;
+    }
+
+    // POLICY_PROCESS, the workers write the product and take chunks in a shared mapping
+    size_t mapLen = sizeof(threadData) + (sizeof(int *) + sizeof(int) * SIZE) * data->rows;
+    char *map = mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    threadData *shared = (threadData *) map;
+    int **rows = (int **) (map + sizeof(threadData));
+    int *product = (int *) (map + sizeof(threadData) + sizeof(int *) * data->rows);
+    *shared = *data;
+    shared->R = rows;
+    shared->offset = 0;
+    for (int i = 0; i < data->rows; i++)
+        rows[i] = product + i * SIZE;
+
+    pid_t pids[plan->workers];
+    for (int i = 0; i < plan->workers; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            fprintf(stderr, "error: fork failed\n");
+            perror("fork");
+            exit(1);
+        }
+        if (pids[i] == 0) {
+            int cpu = workerCpu(i);
+            if (cpu >= 0) {
+                cpu_set_t one;
+                CPU_ZERO(&one);
+                CPU_SET(cpu, &one);
+                sched_setaffinity(0, sizeof(one), &one);
+            }
+            computeChunks(shared);
+            _exit(0); // Not exit, stdout belongs to the parent
+        }
+    }
+    for (int i = 0; i < plan->workers; i++)
+        waitpid(pids[i], NULL, 0);
+
+    for (int i = 0; i < data->rows; i++)
+        memcpy(data->R[i + data->offset], rows[i], sizeof(int) * SIZE);
+    munmap(map, mapLen);
+}
+
+/*
+ * This function computes a big product with work stealing. The output is cut into TILE x TILE tiles, each
+ * worker starts with an equal run of them in its own deque and when that is empty it steals from the top of
+ * random victims' deques, so a slow core or an expensive part of the matrix does not hold up the rest.
+ * Assumption: plan->workers > 0, data is filled in
+ * Input parameters: const execPlan *plan, threadData *data
+ * Returns: void, fills R by reference
+*/
+void runStealing(const execPlan *plan, threadData *data) {
+    int tilesPerRow = (SIZE + TILE - 1) / TILE;
+    int numTiles = tilesPerRow * ((data->rows + TILE - 1) / TILE);
+    int numWorkers = plan->workers < numTiles ? plan->workers : numTiles; // A worker without a tile would idle
+    if (numWorkers < 1)
+        numWorkers = 1;
+    tileDeque deques[numWorkers];
+    stealWorker workers[numWorkers];
+    pthread_t threads[numWorkers];
+
+    for (int i = 0; i < numWorkers; i++) {
+        // Worker i owns tiles [first, last), neighbouring tiles share rows of A
+        int first = (int) ((long) numTiles * i / numWorkers);
+        int last = (int) ((long) numTiles * (i + 1) / numWorkers);
+        deques[i].tiles = malloc(sizeof(int) * (last - first + 1));
+        for (int t = first; t < last; t++)
+            deques[i].tiles[t - first] = t;
+        deques[i].top = 0;
+        deques[i].bottom = last - first;
+        pthread_mutex_init(&deques[i].lock, NULL);
+
+        workers[i].data = data;
+        workers[i].deques = deques;
+        workers[i].workers = numWorkers;
+        workers[i].self = i;
+        workers[i].seed = (unsigned int) (getpid() * 31 + i);
+    }
+
+    for (int i = 0; i < numWorkers; i++) {
+        pthread_attr_t attr;
+        pinThread(&attr, i);
+        pthread_create(&threads[i], &attr, stealRun, &workers[i]);
+        pthread_attr_destroy(&attr);
+    }
+    for (int i = 0; i < numWorkers; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < numWorkers; i++) {
+        pthread_mutex_destroy(&deques[i].lock);
+        free(deques[i].tiles);
+    }
+}
+
+/*
+ * This function is a work stealing worker, it computes its own tiles and then steals until none are left
+ * Assumption: To be ran as a thread
+ * Input parameters: void* givenWorker (a stealWorker)
+ * Returns: NULL once every deque is empty
+*/
+void* stealRun(void* givenWorker) {
+    stealWorker *worker = (stealWorker*) givenWorker;
+    int tilesPerRow = (SIZE + TILE - 1) / TILE;
+
+    while (1) {
+        int tile = dequePop(&worker->deques[worker->self], 0);
+
+        // Own deque is empty, try random victims, then every deque once before giving up
+        for (int tries = 0; tile < 0 && tries < 2 * worker->workers; tries++)
+            tile = dequePop(&worker->deques[rand_r(&worker->seed) % worker->workers], 1);
+        for (int victim = 0; tile < 0 && victim < worker->workers; victim++)
+            tile = dequePop(&worker->deques[victim], 1);
+        if (tile < 0)
+            break;
+
+        int firstRow = (tile / tilesPerRow) * TILE;
+        int firstCol = (tile % tilesPerRow) * TILE;
+        int rows = worker->data->rows;
+        // Compute the tile, only while holding a token
+        jobserverAcquire();
+        computeTile(worker->data, firstRow, firstRow + TILE < rows ? firstRow + TILE : rows,
+                    firstCol, firstCol + TILE < SIZE ? firstCol + TILE : SIZE);
+        jobserverRelease();
+    }
+    return NULL;
+}
+
+/*
+ * This function takes a tile off a deque, the owner takes the bottom and a thief the top
+ * Assumption: none
+ * Input parameters: tileDeque *deque, int fromTop
+ * Returns: int the tile number, or -1 if the deque is empty
+*/
+int dequePop(tileDeque *deque, int fromTop) {
+    int tile = -1;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->top < deque->bottom)
+        tile = fromTop ? deque->tiles[deque->top++] : deque->tiles[--deque->bottom];
+    pthread_mutex_unlock(&deque->lock);
+    return tile;
+}
+
+/*
+ * This function parses the POLICY set by the parent
+ * Assumption: NULL or anything unknown means auto
+ * Input parameters: const char *policy
+ * Returns: int one of the POLICY_ values
+*/
+int parsePolicy(const char *policy) {
+    for (int i = POLICY_SERIAL; policy && i < POLICY_AUTO; i++) {
+        if (strcmp(policy, policyNames[i]) == 0)
+            return i;
+    }
+    return POLICY_AUTO;
+}
+
+/*
+ * This function picks how to compute a rows x inner by inner x cols product. Each policy is costed as its
+ * spawn cost per worker plus the kernel time split across the workers, the cheapest one wins. Chunks are
+ * a quarter of each worker's share of rows so a slow worker can be made up for by the others.
+ * Assumption: cost is calibrated
+ * Input parameters: const costModel *cost, int policy (POLICY_AUTO or forced), int workers (0 lets the model
+ *                   pick, a forced count is cut to the cores and rows), int rows, int cols, int inner
+ * Returns: execPlan
+*/
+execPlan planFor(const costModel *cost, int policy, int workers, int rows, int cols, int inner) {
+    double workUs = (double) rows * cols * inner * cost->maddNs / 1000.0;
+    int maxWorkers = cost->cores < rows ? cost->cores : rows;
+    execPlan plan = {POLICY_SERIAL, 1, rows};
+    double best = workUs;
+
+    if (maxWorkers < 1)
+        maxWorkers = 1;
+    if (workers > maxWorkers)
+        workers = maxWorkers; // The workers live in VLAs on the stack, and ones past the rows would only idle
+    if (policy == POLICY_THREADED || policy == POLICY_PROCESS)
+        best = -1; // Forced, only the number of workers is up to the model
+
+    for (int p = POLICY_THREADED; p <= POLICY_PROCESS; p++) {
+        if (policy != POLICY_AUTO && policy != p)
+            continue;
+        double spawnUs = p == POLICY_THREADED ? cost->threadUs : cost->forkUs;
+        int least = workers > 0 ? workers : policy == POLICY_AUTO ? 2 : 1;
+        int most = workers > 0 ? workers : maxWorkers;
+        for (int n = least; n <= most; n++) {
+            double total = spawnUs * n + workUs / n;
+            if (best < 0 || total < best) {
+                best = total;
+                plan.policy = p;
+                plan.workers = n;
+            }
+        }
+    }
+
+    plan.grain = rows / (plan.workers * 4) > 0 ? rows / (plan.workers * 4) : 1;
+    if (plan.policy == POLICY_SERIAL)
+        plan.grain = rows;
+    return plan;
+}
+
+/*
+ * This function loads the cost model from the PROFILE file, or calibrates and saves it there
+ * Assumption: profile may be NULL, then it is calibrated every run
+ * Input parameters: costModel *cost, const char *profile
+ * Returns: void, fills cost by reference
+*/
+void loadCostModel(costModel *cost, const char *profile) {
+    FILE *file = profile ? fopen(profile, "r") : NULL;
+    if (file) {
+        int got = fscanf(file, "thread %lf fork %lf madd %lf cores %d", &cost->threadUs, &cost->forkUs,
+                         &cost->maddNs, &cost->cores);
+        fclose(file);
+        cost->cores = availableCores(); // The profile may have been saved by a child pinned elsewhere
+        if (got == 4)
+            return;
+    }
+
+    calibrate(cost);
+    if (profile) {
+        // Every child may be calibrating at once, so write a private file and rename it into place
+        char tmp[NAME_SIZE + 16];
+        snprintf(tmp, sizeof(tmp), "%s.%d", profile, getpid());
+        file = fopen(tmp, "w");
+        if (file) {
+            fprintf(file, "thread %f fork %f madd %f cores %d\n", cost->threadUs, cost->forkUs, cost->maddNs,
+                    cost->cores);
+            fclose(file);
+            rename(tmp, profile);
+        }
+    }
+}
+
+/*
+ * This function measures what the plan needs: a thread spawn, a fork and one multiply-add of the kernel
+ * Assumption: Called once at startup, takes a few milliseconds
+ * Input parameters: costModel *cost
+ * Returns: void, fills cost by reference
+*/
+void calibrate(costModel *cost) {
+    struct timespec start, finish;
+    const int spawns = 8;
+    const int n = 64; // Scratch matrix size for the kernel timing
+    pthread_t thread;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < spawns; i++) {
+        pthread_create(&thread, NULL, emptyWorker, NULL);
+        pthread_join(thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    cost->threadUs = ((finish.tv_sec - start.tv_sec) * 1e9 + (finish.tv_nsec - start.tv_nsec)) / 1000.0 / spawns;
+
+    fflush(stdout); // Nothing buffered may be written twice by the forked workers
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < spawns; i++) {
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(0);
+        waitpid(pid, NULL, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    cost->forkUs = ((finish.tv_sec - start.tv_sec) * 1e9 + (finish.tv_nsec - start.tv_nsec)) / 1000.0 / spawns;
+
+    // Time the same loop as computeRows on scratch matrices until it has run for at least 2 ms
+    int *a = calloc(n * n, sizeof(int));
+    int *b = calloc(n * n, sizeof(int));
+    int *c = calloc(n * n, sizeof(int));
+    for (int i = 0; i < n * n; i++) {
+        a[i] = i % 7;
+        b[i] = i % 5;
+    }
+    long reps = 0;
+    double elapsedNs;
+    volatile int sink = 0; // Keeps the compiler from dropping the loop
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        for (int r = 0; r < n; r++) {
+            for (int col = 0; col < n; col++) {
+                int sum = 0;
+                for (int k = 0; k < n; k++)
+                    sum += a[r * n + k] * b[k * n + col];
+                c[r * n + col] = sum;
+            }
+        }
+        sink += c[reps % (n * n)];
+        reps++;
+        clock_gettime(CLOCK_MONOTONIC, &finish);
+        elapsedNs = (finish.tv_sec - start.tv_sec) * 1e9 + (finish.tv_nsec - start.tv_nsec);
+    } while (elapsedNs < 2e6);
+    cost->maddNs = elapsedNs / ((double) reps * n * n * n);
+    free(a);
+    free(b);
+    free(c);
+
+    cost->cores = availableCores();
+}
+
+/*
+ * This function counts the cpus we may run on, fewer than online if the parent pinned us
+ * Assumption: none
+ * Input parameters: none
+ * Returns: int
+*/
+int availableCores(void) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+        return CPU_COUNT(&set);
+    return (int) sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+/*
+ * This function picks the cpu for a worker, round robin over the cpus we were pinned to
+ * Assumption: pinWorkers says if workerCpus is set
+ * Input parameters: int worker
+ * Returns: int the cpu, or -1 to leave the worker unpinned
+*/
+int workerCpu(int worker) {
+    int count = pinWorkers ? CPU_COUNT(&workerCpus) : 0;
+    if (count == 0)
+        return -1;
+
+    int nth = worker % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &workerCpus) && nth-- == 0)
+            return cpu;
+    }
+    return -1;
+}
+
+/*
+ * This function sets up the attributes of a worker thread, pinned to its cpu if AFFINITY is set
+ * Assumption: attr is destroyed by the caller after pthread_create
+ * Input parameters: pthread_attr_t *attr, int worker
+ * Returns: void
+*/
+void pinThread(pthread_attr_t *attr, int worker) {
+    int cpu = workerCpu(worker);
+    pthread_attr_init(attr);
+    if (cpu >= 0) {
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        pthread_attr_setaffinity_np(attr, sizeof(one), &one);
+    }
+}
+
+/*
+ * This function does nothing, it is what a thread spawn is timed with
+ * Assumption: To be ran as a thread
+ * Input parameters: void* unused
+ * Returns: NULL
+*/
+void* emptyWorker(void* unused) {
+    return unused;
+}
+
+/*
+ * This function reads the JOBSERVER fds from the environment
+ * Assumption: Set by the parent as "readfd,writefd"
+ * Input parameters: none
+ * Returns: void, jobRead and jobWrite stay -1 without a JOBSERVER
+*/
+void jobserverOpen(void) {
+    char *jobserver = getenv("JOBSERVER");
+    if (!jobserver || sscanf(jobserver, "%d,%d", &jobRead, &jobWrite) != 2)
+        jobRead = jobWrite = -1;
+}
+
+/*
+ * This function takes a token from the JOBSERVER pipe, waiting until a compute worker anywhere in the tree
+ * gives one back
+ * Assumption: jobserverOpen was called, does nothing without a JOBSERVER
+ * Input parameters: none
+ * Returns: void
+*/
+void jobserverAcquire(void) {
+    char token;
+    if (jobRead < 0)
+        return;
+    while (read(jobRead, &token, 1) < 0 && errno == EINTR)
+        ; // Interrupted, try again
+}
+
+/*
+ * This function gives a token back to the JOBSERVER pipe
+ * Assumption: jobserverAcquire was called by this worker
+ * Input parameters: none
+ * Returns: void
+*/
+void jobserverRelease(void) {
+    char token = '+';
+    if (jobWrite >= 0)
+        write(jobWrite, &token, 1);
+}
+
+/*
+ * This function parses the STREAM flush policy, e.g. "1", "8", "250ms" or "8,250ms"
+ * Assumption: A bare number is a product count, a number ending in ms is a time interval
+ * Input parameters: const char *policy, streamWriter *writer
+ * Returns: void, sets flushEvery and flushMs (flush every product if nothing usable is given)
+*/
+void parseFlushPolicy(const char *policy, streamWriter *writer) {
+    writer->flushEvery = 0;
+    writer->flushMs = 0;
+
+    const char *p = policy;
+    while (*p) {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p) break; // Not a number, stop parsing
+        if (strncmp(end, "ms", 2) == 0) {
+            writer->flushMs = value;
+            end += 2;
+        } else {
+            writer->flushEvery = (int) value;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    if (writer->flushEvery <= 0 && writer->flushMs <= 0)
+        writer->flushEvery = 1;
+}
+
+/*
+ * This function starts the streaming writer thread
+ * Assumption: parseFlushPolicy has already been called on writer
+ * Input parameters: streamWriter *writer, const char *wName
+ * Returns: void
+*/
+void streamWriterStart(streamWriter *writer, const char *wName) {
+    writer->head = 0;
+    writer->count = 0;
+    writer->done = 0;
+    writer->wName = wName;
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->notEmpty, NULL);
+    pthread_cond_init(&writer->notFull, NULL);
+    pthread_create(&writer->thread, NULL, streamWriterRun, writer);
+}
+
+/*
+ * This function queues a copy of a product for the writer thread
+ * Assumption: R has SIZE rows, called only by the compute (main) thread
+ * Input parameters: streamWriter *writer, int iterationNum, const char *name, int **R
+ * Returns: void, blocks while the ring is full so memory stays bounded
+*/
+void streamWriterPush(streamWriter *writer, int iterationNum, const char *name, int **R) {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->count == RING_SLOTS)
+        pthread_cond_wait(&writer->notFull, &writer->lock);
+
+    resultSlot *slot = &writer->ring[(writer->head + writer->count) % RING_SLOTS];
+    slot->iterationNum = iterationNum;
+    snprintf(slot->name, NAME_SIZE, "%s", name);
+    for (int i = 0; i < SIZE; i++)
+        memcpy(slot->R[i], R[i], sizeof(int) * SIZE);
+    writer->count++;
+
+    pthread_cond_signal(&writer->notEmpty);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/*
+ * This function drains the ring, stops the writer thread and flushes what is left
+ * Assumption: No more streamWriterPush calls after this
+ * Input parameters: streamWriter *writer
+ * Returns: void
+*/
+void streamWriterClose(streamWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->done = 1;
+    pthread_cond_signal(&writer->notEmpty);
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_join(writer->thread, NULL);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->notEmpty);
+    pthread_cond_destroy(&writer->notFull);
+}
+
+/*
+ * This function is the streaming writer thread, it prints each product and flushes per the policy
+ * Assumption: To be ran as a thread, it is the only thread printing to stdout while streaming
+ * Input parameters: void* givenWriter (a streamWriter)
+ * Returns: NULL when the writer is closed and the ring is empty
+*/
+void* streamWriterRun(void* givenWriter) {
+    streamWriter *writer = (streamWriter*) givenWriter;
+    struct timespec lastFlush;
+    int pending = 0; // Products written to the stdio buffer but not flushed yet
+    resultSlot slot;
+
+    clock_gettime(CLOCK_REALTIME, &lastFlush);
+    pthread_mutex_lock(&writer->lock);
+    while (1) {
+        while (writer->count == 0 && !writer->done) {
+            if (pending && writer->flushMs) {
+                // Sleep until the flush interval is up, then flush whatever is pending
+                struct timespec deadline = lastFlush;
+                deadline.tv_sec += writer->flushMs / 1000;
+                deadline.tv_nsec += (writer->flushMs % 1000) * 1000000;
+                if (deadline.tv_nsec >= 1000000000) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000;
+                }
+                if (pthread_cond_timedwait(&writer->notEmpty, &writer->lock, &deadline) == ETIMEDOUT) {
+                    fflush(stdout);
+                    pending = 0;
+                    clock_gettime(CLOCK_REALTIME, &lastFlush);
+                }
+            } else {
+                pthread_cond_wait(&writer->notEmpty, &writer->lock);
+            }
+        }
+        if (writer->count == 0 && writer->done) break;
+
+        // Copy the slot out so the compute thread can refill it while we format
+        slot = writer->ring[writer->head];
+        writer->head = (writer->head + 1) % RING_SLOTS;
+        writer->count--;
+        pthread_cond_signal(&writer->notFull);
+        pthread_mutex_unlock(&writer->lock);
+
+        fprintf(stdout, "%s x %s\n", slot.name, writer->wName);
+        fprintf(stdout, "rMatrix for A matrix %d=[\n", slot.iterationNum);
+        for (int i = 0; i < SIZE; i++) {
+            for (int j = 0; j < SIZE; j++)
+                fprintf(stdout, "%d ", slot.R[i][j]);
+            fprintf(stdout, "\n");
+        }
+        fprintf(stdout, "]\n");
+        pending++;
+
+        // Flush on count, or on time if the stream is busy enough that we never sleep
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        long sinceFlushMs = (now.tv_sec - lastFlush.tv_sec) * 1000 + (now.tv_nsec - lastFlush.tv_nsec) / 1000000;
+        if ((writer->flushEvery && pending >= writer->flushEvery) ||
+            (writer->flushMs && sinceFlushMs >= writer->flushMs)) {
+            fflush(stdout);
+            pending = 0;
+            lastFlush = now;
+        }
+
+        pthread_mutex_lock(&writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    fflush(stdout);
+    return NULL;
+}
+
+/*
+ * This function maps the result store the parent created
+ * Assumption: The parent wrote the header before forking, STORE_INDEX is this child's W number
+ * Input parameters: const char *path, int index
+ * Returns: resultStore* (exits if the store cannot be opened or mapped)
+*/
+resultStore *storeOpen(const char *path, int index) {
+    storeHeader header;
+    struct stat st;
+    resultStore *store = malloc(sizeof(resultStore));
+
+    store->fd = open(path, O_RDWR);
+    if (store->fd < 0 || pread(store->fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, "MMSTORE1", 8) != 0 || header.size != SIZE ||
+        header.recordSize != sizeof(storeRecord)) {
+        fprintf(stderr, "error: cannot open result store %s\n", path);
+        exit(1);
+    }
+
+    fstat(store->fd, &st);
+    store->index = index;
+    store->numW = header.numW;
+    store->recordSize = header.recordSize;
+    store->dataOffset = header.dataOffset;
+    store->mapLen = st.st_size;
+    store->map = mmap(NULL, store->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+    if (store->map == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return store;
+}
+
+/*
+ * This function writes one product to its record, growing the file if seq is past the preallocated end
+ * Assumption: R has SIZE rows, posix_fallocate never shrinks so children can grow the file concurrently
+ * Input parameters: resultStore *store, int seq, const char *name, int **R
+ * Returns: int 0, or -1 if the file could not grow (nothing is written, the old mapping is kept)
+*/
+int storePut(resultStore *store, int seq, const char *name, int **R) {
+    size_t offset = store->dataOffset + ((size_t) seq * store->numW + store->index) * store->recordSize;
+
+    if (offset + store->recordSize > store->mapLen) {
+        // Another child may have grown it already, otherwise double it
+        struct stat st;
+        fstat(store->fd, &st);
+        size_t newLen = st.st_size;
+        if (offset + store->recordSize > newLen) {
+            newLen = newLen * 2 > offset + store->recordSize ? newLen * 2 : offset + store->recordSize;
+            // Mapping past the blocks really on disk would SIGBUS on the first write if the disk is full
+            int err = posix_fallocate(store->fd, 0, (off_t) newLen);
+            if (err != 0) {
+                fprintf(stderr, "error: cannot grow result store to %zu bytes: %s\n", newLen, strerror(err));
+                return -1;
+            }
+        }
+        munmap(store->map, store->mapLen);
+        store->mapLen = newLen;
+        store->map = mmap(NULL, store->mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+        if (store->map == MAP_FAILED) {
+            perror("mmap");
+            exit(1);
+        }
+    }
+
+    storeRecord *record = (storeRecord *) (store->map + offset);
+    record->seq = seq;
+    snprintf(record->name, NAME_SIZE, "%s", name);
+    for (int i = 0; i < SIZE; i++)
+        memcpy(record->R[i], R[i], sizeof(int) * SIZE);
+    __atomic_store_n(&record->valid, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * This function unmaps and closes the result store
+ * Assumption: store came from storeOpen
+ * Input parameters: resultStore *store
+ * Returns: void
+*/
+void storeClose(resultStore *store) {
+    munmap(store->map, store->mapLen);
+    close(store->fd);
+    free(store);
+}
+
+/*
+ * This function is the zygote. It loads every W, the jobserver and the cost model once, then forks a worker
+ * for each request from the parent. The workers start with all of that already in memory (copy on write),
+ * so a child costs a fork instead of an exec, a W parse and a calibration. Exits are reported to the parent
+ * on the exit pipe.
+ * Assumption: ZYGOTE is "socket,exitpipe", argv[2...] are every W file in command order
+ * Input parameters: const char *zygote, char *argv[], int (**W)[SIZE], matrixShape *shapeW, costModel *cost
+ * Returns: int the command number, only in a worker. The zygote itself exits once the parent has closed the
+ *          socket and every worker is gone
+*/
+int zygoteServe(const char *zygote, char *argv[], int (**W)[SIZE], matrixShape *shapeW, costModel *cost) {
+    int sock, exitFd;
+    if (sscanf(zygote, "%d,%d", &sock, &exitFd) != 2) {
+        fprintf(stderr, "error: bad ZYGOTE %s\n", zygote);
+        exit(1);
+    }
+
+    // Every W the parent will ask for, NULL if it cannot be opened so only that worker fails
+    int numW = 0;
+    while (argv[numW + 2])
+        numW++;
+    int (**Ws)[SIZE] = malloc(sizeof(int (*)[SIZE]) * numW);
+    matrixShape *shapes = malloc(sizeof(matrixShape) * numW);
+    for (int i = 0; i < numW; i++) {
+        FILE *fileW = fopen(argv[i + 2], "r");
+        Ws[i] = NULL;
+        if (fileW) {
+            Ws[i] = calloc(SIZE, sizeof(int[SIZE]));
+            shapes[i] = readFile(fileW, SIZE, SIZE, Ws[i]);
+            fclose(fileW);
+        }
+    }
+    jobserverOpen();
+    loadCostModel(cost, getenv("PROFILE"));
+
+    // SIGCHLD as a file, so one poll waits for both requests and exiting workers
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int sigFd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    zygoteExit exited;
+    int accepting = 1;
+    while (accepting) {
+        struct pollfd fds[2] = {{sigFd, POLLIN, 0}, {sock, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0)
+            continue; // EINTR
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            read(sigFd, &info, sizeof(info));
+            while ((exited.pid = waitpid(-1, &exited.status, WNOHANG)) > 0)
+                write(exitFd, &exited, sizeof(exited));
+        }
+
+        if (fds[1].revents) {
+            int command = zygoteFork(sock, argv, numW, Ws, shapes, W, shapeW);
+            if (command > 0) {
+                // Worker only code below here
+                close(sock);
+                close(exitFd);
+                close(sigFd);
+                sigprocmask(SIG_UNBLOCK, &mask, NULL);
+                return command;
+            }
+            accepting = command == 0; // -1 once the parent closed the socket, every child it wanted is started
+        }
+    }
+
+    // Report the rest of the workers as they exit, then we are done
+    while ((exited.pid = waitpid(-1, &exited.status, 0)) > 0)
+        write(exitFd, &exited, sizeof(exited));
+    exit(0);
+}
+
+/*
+ * This function takes one request off the zygote socket and forks its worker. The worker redirects stdout and
+ * stderr to PID.out and PID.err and its stdin to the request pipe like matrixMultParallel does in the parent,
+ * pins itself and sets the environment the parent would have given it.
+ * Assumption: sock is the zygote's end of the parent's socketpair
+ * Input parameters: int sock, char *argv[], int numW, int (**Ws)[SIZE] (every W), const matrixShape *shapes (of
+ *                   every W), int (**W)[SIZE] and matrixShape *shapeW (set in the worker)
+ * Returns: int the command number in the worker, (0) in the zygote, (-1) in the zygote if the socket is closed
+*/
+int zygoteFork(int sock, char *argv[], int numW, int (**Ws)[SIZE], const matrixShape *shapes, int (**W)[SIZE],
+               matrixShape *shapeW) {
+    zygoteRequest ask;
+    int fds[2] = {-1, -1}; // stdin pipe, result pipe
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {&ask, sizeof(ask)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) <= 0)
+        return -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(fds, CMSG_DATA(cmsg), cmsg->cmsg_len - CMSG_LEN(0));
+
+    pid_t pid = ask.command >= 1 && ask.command <= numW ? fork() : -1;
+    if (pid != 0) {
+        // Zygote, the worker has its own copies of the pipes now
+        for (int i = 0; i < 2; i++) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+        }
+        send(sock, &pid, sizeof(pid), 0); // -1 tells the parent to fork this child itself
+        return 0;
+    }
+
+    // Worker only code below here, for each child, redirect stdout and stderr to a file
+    char out[100];
+    char err[100];
+    sprintf(out, "%d.out", getpid());
+    sprintf(err, "%d.err", getpid());
+    int newStdOut = open(out, O_RDWR | O_CREAT | O_APPEND, 0666);
+    int newStdErr = open(err, O_RDWR | O_CREAT | O_APPEND, 0666);
+    dup2(newStdOut, STDOUT_FILENO);
+    dup2(newStdErr, STDERR_FILENO);
+    dup2(fds[0], STDIN_FILENO);
+    close(newStdOut);
+    close(newStdErr);
+    close(fds[0]);
+
+    // The same variables matrixMultParallel or spawnChild set, main reads them as usual
+    char value[20];
+    sprintf(value, "%d", ask.command);
+    setenv("COMMAND", value, 1);
+    sprintf(value, "%d", ask.command - 1);
+    setenv("STORE_INDEX", value, 1);
+    if (fds[1] >= 0) {
+        fcntl(fds[1], F_SETFD, 0);
+        sprintf(value, "%d", fds[1]);
+        setenv("RESULT", value, 1);
+    }
+    // Our W was touched by the zygote, only what we allocate from here on is local to these cpus
+    if (ask.pinned && sched_setaffinity(0, sizeof(cpu_set_t), &ask.cpus) == 0)
+        setenv("PINNED", ask.cpuList, 1);
+
+    argv[2] = argv[ask.command + 1];
+    argv[3] = NULL;
+    *W = Ws[ask.command - 1]; // NULL if the zygote could not open it, main fails the same way as without -z
+    if (*W)
+        *shapeW = shapes[ask.command - 1];
+    return ask.command;
+}
@@ -0,0 +1,140 @@
+/*
+ * Description: Measures how long it takes to start a child with fork+exec, vfork+exec and posix_spawn as the
+ *              parent's memory grows, the choice behind matrixmult_multiwa -x
+ * Author names: Trevor Mathisen
+ * Author emails: trevor.mathisen@sjsu.edu
+ * Last modified date: 10/18/2026
+ * Creation date: 10/18/2026
+ */
+
+/* Example:
+    $ gcc -O2 -o spawn_bench spawn_bench.c -Wall -Werror
+    $ ./spawn_bench
+    Parent MB   fork+exec us   vfork+exec us   posix_spawn us
+            0          621.2           507.5            577.3
+           64         1806.1           456.1            557.3
+    ...
+
+    Other sizes in MB and the number of children started for each:
+    $ ./spawn_bench -n 50 0 128 2048
+ */
+
+#define _GNU_SOURCE // vfork
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#define RUNS 100 // Children started per method and size by default (-n)
+#define CHILD "/bin/true" // Does nothing, so only starting it is measured
+
+enum { SPAWN_FORK, SPAWN_VFORK, SPAWN_POSIX }; // How a child is started
+
+extern char **environ;
+
+// Function prototypes
+double timeSpawns(int method, int runs);
+pid_t startChild(int method);
+double nowUs(void);
+
+int main(int argc, char* argv[]) {
+    int runs = RUNS;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                runs = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n runs] [MB ...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    // Parent sizes to measure at, in MB, grown one after the other
+    long defaults[] = {0, 64, 256, 1024};
+    int numSizes = argc > optind ? argc - optind : 4;
+    long *sizes = malloc(sizeof(long) * numSizes);
+    for (int i = 0; i < numSizes; i++)
+        sizes[i] = argc > optind ? atol(argv[optind + i]) : defaults[i];
+
+    fprintf(stdout, "Parent MB   fork+exec us   vfork+exec us   posix_spawn us\n");
+    for (int i = 0; i < numSizes; i++) {
+        // Touch every page so the memory is really mapped, fork has to copy a page table entry for each
+        char *memory = NULL;
+        size_t bytes = (size_t) sizes[i] << 20;
+        if (bytes) {
+            memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                fprintf(stderr, "error: cannot map %ld MB\n", sizes[i]);
+                return 1;
+            }
+            memset(memory, 1, bytes);
+        }
+
+        fprintf(stdout, "%9ld %14.1f %15.1f %16.1f\n", sizes[i], timeSpawns(SPAWN_FORK, runs),
+                timeSpawns(SPAWN_VFORK, runs), timeSpawns(SPAWN_POSIX, runs));
+        fflush(stdout);
+        if (memory)
+            munmap(memory, bytes);
+    }
+
+    free(sizes);
+    return 0;
+}
+
+/*
+ * This function starts runs children one after the other with the given method and waits for each one
+ * Assumption: CHILD exists
+ * Input parameters: int method, int runs
+ * Returns: double, the average microseconds from starting a child until it has exited and been reaped
+*/
+double timeSpawns(int method, int runs) {
+    double start = nowUs();
+    for (int i = 0; i < runs; i++) {
+        pid_t pid = startChild(method);
+        if (pid < 0) {
+            perror("spawn");
+            exit(1);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return (nowUs() - start) / runs;
+}
+
+/*
+ * This function starts CHILD once
+ * Assumption: After vfork the child only calls exec or _exit, it shares our memory until then
+ * Input parameters: int method
+ * Returns: pid_t of the child, -1 on error
+*/
+pid_t startChild(int method) {
+    char *args[] = {CHILD, NULL};
+    pid_t pid;
+
+    if (method == SPAWN_POSIX)
+        return posix_spawn(&pid, args[0], NULL, NULL, args, environ) == 0 ? pid : -1;
+
+    pid = method == SPAWN_VFORK ? vfork() : fork();
+    if (pid == 0) {
+        execve(args[0], args, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+/*
+ * This function reads the monotonic clock
+ * Assumption: none
+ * Input parameters: none
+ * Returns: double, microseconds
+*/
+double nowUs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}